@@ -248,38 +248,63 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Whether the page table pgtab maps nothing.
+static int
+pgtab_empty(pte_t *pgtab)
+{
+  int i;
+
+  for(i = 0; i < NPTENTRIES; i++)
+    if(pgtab[i])
+      return 0;
+  return 1;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
+// Goes one page table at a time, skipping the 4MB of each absent
+// one, and frees the page tables left mapping nothing.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
-  pte_t *pte;
-  uint a, pa;
+  pde_t *pde;
+  pte_t *pgtab;
+  uint a, next, end, pa;
+  int i, n;
 
   if(newsz >= oldsz)
     return oldsz;
 
-  a = PGROUNDUP(newsz);
-  for(; a  < oldsz; a += PGSIZE){
-    pte = walkpgdir(pgdir, (char*)a, 0);
-    if(!pte)
-      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
-    else if((*pte & PTE_P) != 0){
-      pa = PTE_ADDR(*pte);
-      if(pa == 0)
-        panic("kfree");
-      char *v = P2V(pa);
-      kfree(v);
-      *pte = 0;
+  end = PGROUNDUP(oldsz);
+  for(a = PGROUNDUP(newsz); a < end; a = next){
+    next = PGADDR(PDX(a) + 1, 0, 0);
+    pde = &pgdir[PDX(a)];
+    if(!(*pde & PTE_P))
+      continue;
+    pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
+    n = ((next < end ? next : end) - a) / PGSIZE;
+    for(i = PTX(a); i < PTX(a) + n; i++){
+      if((pgtab[i] & PTE_P) != 0){
+        pa = PTE_ADDR(pgtab[i]);
+        if(pa == 0)
+          panic("kfree");
+        kfree(P2V(pa));
+        pgtab[i] = 0;
+      }
+    }
+    if(pgtab_empty(pgtab)){
+      kfree((char*)pgtab);
+      *pde = 0;
     }
   }
   return newsz;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part. deallocuvm frees the user page tables,
+// what is left maps the kernel.
 void
 freevm(pde_t *pgdir)
 {
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -17,42 +17,158 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Every buffer sits in the bucket its (dev, blockno) hashes to, and
+// each bucket has its own lock, so lookups of different blocks do not
+// contend. Buffers nobody references are also on the lru list, least
+// recently used first. A miss takes bcache.lock and moves the head of
+// that list to the bucket of the new block, holding at most two
+// bucket locks. binit sizes the cache to a share of physical memory.
+//
+// Lock order: bcache.lock, then bucket locks, then bcache.lrulock.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 
-struct {
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head;             // circular list of the bufs hashed here
+  uint hits;
+  uint misses;
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;        // serializes moving bufs between buckets
+  struct spinlock lrulock;     // protects lru
+  struct buf lru;              // circular list of the bufs with refcnt 0
+  int nbuf;
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static struct bucket*
+hash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+static void
+bucket_insert(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+// Take a reference to b. Must hold the lock of b's bucket.
+static void
+bhold(struct buf *b)
+{
+  if(b->refcnt++ == 0){
+    acquire(&bcache.lrulock);
+    b->lnext->lprev = b->lprev;
+    b->lprev->lnext = b->lnext;
+    release(&bcache.lrulock);
+  }
+}
+
+// Drop a reference to b; the last one makes it the most recently
+// used free buf. Must hold the lock of b's bucket.
+static void
+bdrop(struct buf *b)
+{
+  if(--b->refcnt == 0){
+    acquire(&bcache.lrulock);
+    b->lnext = &bcache.lru;
+    b->lprev = bcache.lru.lprev;
+    bcache.lru.lprev->lnext = b;
+    bcache.lru.lprev = b;
+    release(&bcache.lrulock);
+  }
+}
+
+// Carve n bytes out of a page, taking a new one when the current
+// one is used up; chunks never cross a page. Returns 0 when out
+// of memory.
+static char*
+chunk(char **page, int *left, int n)
+{
+  if(*left < n){
+    if((*page = kalloc()) == 0)
+      return 0;
+    *left = PGSIZE;
+  }
+  *left -= n;
+  return *page + *left;
+}
+
+// Allocate a buf outside the cache, for I/O on a private copy of
+// a block. bufs and their data are packed into pages and the data
+// never crosses one, so DMA reaches it as one region. Only for
+// initialization: not safe to call concurrently.
+struct buf*
+bnew(void)
+{
+  static char *bpage, *dpage;
+  static int bleft, dleft;
+  struct buf *b;
+  uchar *data;
+
+  if((data = (uchar*)chunk(&dpage, &dleft, BSIZE)) == 0 ||
+     (b = (struct buf*)chunk(&bpage, &bleft, sizeof(struct buf))) == 0)
+    return 0;
+  memset(b, 0, sizeof(*b));
+  b->data = data;
+  initsleeplock(&b->lock, "buffer");
+  return b;
+}
+
+// Allocate 1/BCACHEFRAC of physical memory to buffers, at least NBUF
+// and at most NBUFMAX of them. Must come after kinit2.
 void
 binit(void)
 {
+  extern char end[];
+  struct bucket *bk;
   struct buf *b;
+  int i, n;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.lrulock, "bcache.lru");
+  bcache.lru.lprev = &bcache.lru;
+  bcache.lru.lnext = &bcache.lru;
+  for(bk = bcache.bucket; bk < &bcache.bucket[NBUCKET]; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
 
-//PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  n = (PHYSTOP - V2P(end)) / BCACHEFRAC / (sizeof(struct buf) + BSIZE);
+  if(n < NBUF)
+    n = NBUF;
+  if(n > NBUFMAX)
+    n = NBUFMAX;
+
+  // the cache never shrinks. Empty bufs claim block i of device 0,
+  // which no lookup asks for, to spread over the buckets.
+  for(i = 0; i < n; i++){
+    if((b = bnew()) == 0)
+      break;
+    b->blockno = i;
+    bucket_insert(hash(0, i), b);
+    b->refcnt = 1;
+    bdrop(b);
   }
+  if(i < NBUF)
+    panic("binit: out of memory");
+  bcache.nbuf = i;
 }
 
 // Look through buffer cache for block on device dev.
@@ -61,35 +177,75 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
+  struct bucket *bk = hash(dev, blockno), *vbk;
   struct buf *b;
 
-  acquire(&bcache.lock);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head.next; b != &bk->head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
+      bhold(b);
+      bk->hits++;
+      release(&bk->lock);
       acquiresleep(&b->lock);
       return b;
     }
   }
+  release(&bk->lock);
+
+  // Not cached; recycle the least recently used unused buffer.
+  // log.c pins the buffers it has modified but not yet installed
+  // by holding a reference.
+  // Only one miss at a time takes a second bucket lock, so holding
+  // two of them cannot deadlock.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
+  // another process may have cached it meanwhile
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      bhold(b);
+      bk->hits++;
+      release(&bk->lock);
       release(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
     }
   }
-  panic("bget: no buffers");
+
+  // Only misses move bufs between buckets, so the bucket of the
+  // head of lru stays put; but a hit may take the buf before we
+  // hold that bucket's lock, and then we look again.
+  for(;;){
+    acquire(&bcache.lrulock);
+    b = bcache.lru.lnext;
+    release(&bcache.lrulock);
+    if(b == &bcache.lru)
+      panic("bget: no buffers");
+    vbk = hash(b->dev, b->blockno);
+    if(vbk != bk)
+      acquire(&vbk->lock);
+    if(b->refcnt == 0)
+      break;
+    if(vbk != bk)
+      release(&vbk->lock);
+  }
+
+  bhold(b);
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  if(vbk != bk)
+    release(&vbk->lock);
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  bucket_insert(bk, b);
+  bk->misses++;
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -105,6 +261,55 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Whether the block is in the cache, valid or being read.
+int
+bcached(uint dev, uint blockno)
+{
+  struct bucket *bk = hash(dev, blockno);
+  struct buf *b;
+
+  acquire(&bk->lock);
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      release(&bk->lock);
+      return 1;
+    }
+  }
+  release(&bk->lock);
+  return 0;
+}
+
+// Completion of a bprefetch read, in the disk interrupt: release
+// the buf on behalf of the process that started it.
+static void
+prefetched(struct buf *b)
+{
+  struct bucket *bk;
+
+  releasesleep(&b->lock);
+  bk = hash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  bdrop(b);
+  release(&bk->lock);
+}
+
+// Start reading a block into the cache, unless it is there
+// already, and return without waiting for the disk.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if(bcached(dev, blockno))
+    return;
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  idesubmit(b, prefetched);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,29 +320,99 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Start writing b to disk and return at once.  b stays locked:
+// bwait for the write before using or releasing it.
+void
+bwrite_start(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_start");
+  b->flags |= B_DIRTY;
+  idesubmit(b, 0);
+}
+
+// Wait for a write begun by bwrite_start.
+void
+bwait(struct buf *b)
+{
+  ideawait(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Move it to the tail of the lru list when the last reference goes.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // b cannot move to another bucket while referenced
+  bk = hash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  bdrop(b);
+  release(&bk->lock);
+}
+
+// Keep b in the cache without holding it locked: the log pins the
+// bufs whose home copy on disk is not up to date.
+void
+bpin(struct buf *b)
+{
+  struct bucket *bk = hash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  bhold(b);
+  release(&bk->lock);
+}
+
+void
+bunpin(struct buf *b)
+{
+  struct bucket *bk = hash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  bdrop(b);
+  release(&bk->lock);
+}
+
+void
+get_bcache_info(char buf[]) {
+  struct bucket *bk;
+  uint hits = 0, misses = 0;
+  char *c = buf;
+  char helper_buf[20] = {0};
+
+  for(bk = bcache.bucket; bk < &bcache.bucket[NBUCKET]; bk++){
+    acquire(&bk->lock);
+    hits += bk->hits;
+    misses += bk->misses;
+    release(&bk->lock);
   }
-  
-  release(&bcache.lock);
+
+  memmove(c, "Buffers: ", strlen("Buffers: "));
+  c += strlen("Buffers: ");
+  uint_to_str((uint)bcache.nbuf, helper_buf);
+  memmove(c, helper_buf, strlen(helper_buf));
+  c += strlen(helper_buf);
+  memset(helper_buf, 0, sizeof(helper_buf));
+
+  memmove(c, "\nHits: ", strlen("\nHits: "));
+  c += strlen("\nHits: ");
+  uint_to_str(hits, helper_buf);
+  memmove(c, helper_buf, strlen(helper_buf));
+  c += strlen(helper_buf);
+  memset(helper_buf, 0, sizeof(helper_buf));
+
+  memmove(c, "\nMisses: ", strlen("\nMisses: "));
+  c += strlen("\nMisses: ");
+  uint_to_str(misses, helper_buf);
+  memmove(c, helper_buf, strlen(helper_buf));
+  c += strlen(helper_buf);
+  memmove(c, "\n", 1);
 }
 //PAGEBREAK!
 // Blank page.
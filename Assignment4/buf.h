@@ -4,10 +4,14 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // hash bucket list
   struct buf *next;
+  struct buf *lprev; // lru list, while refcnt is 0
+  struct buf *lnext;
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  uint qtime;        // ticks when queued
+  void (*iodone)(struct buf*); // called when the disk is done, or 0
+  uchar *data;       // BSIZE bytes, within one page
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
@@ -0,0 +1,77 @@
+// Processes that create and unlink files at the same time, each in
+// a directory of its own, to time how many metadata updates the log
+// groups into one commit. Run it under make qemu CPUS=1, 2, 4, ...
+// to see how it scales.
+//
+// usage: createbench [nproc [nfiles]]
+// nproc * nfiles must stay well under the 200 inodes mkfs makes.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+void
+worker(int id, int nfiles)
+{
+  char dir[4], path[16];
+  int i, fd;
+
+  dir[0] = 'c';
+  dir[1] = 'b';
+  dir[2] = 'a' + id;
+  dir[3] = 0;
+  if(mkdir(dir) < 0){
+    printf(1, "createbench: mkdir %s failed\n", dir);
+    exit();
+  }
+  memmove(path, dir, 3);
+  path[3] = '/';
+  path[6] = 0;
+  for(i = 0; i < nfiles; i++){
+    path[4] = 'a' + i / 26;
+    path[5] = 'a' + i % 26;
+    if((fd = open(path, O_CREATE | O_RDWR)) < 0){
+      printf(1, "createbench: create %s failed\n", path);
+      exit();
+    }
+    write(fd, path, sizeof(path));
+    close(fd);
+  }
+  for(i = 0; i < nfiles; i++){
+    path[4] = 'a' + i / 26;
+    path[5] = 'a' + i % 26;
+    if(unlink(path) < 0){
+      printf(1, "createbench: unlink %s failed\n", path);
+      exit();
+    }
+  }
+  unlink(dir);
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = 4, nfiles = 20, i, start;
+
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(argc > 2)
+    nfiles = atoi(argv[2]);
+  if(nproc < 1 || nproc > 26)
+    nproc = 4;
+  if(nfiles < 1 || nfiles > 26*26)
+    nfiles = 20;
+
+  start = uptime();
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0)
+      worker(i, nfiles);
+  }
+  for(i = 0; i < nproc; i++)
+    wait();
+  printf(1, "createbench: %d procs x %d files: %d ticks\n",
+         nproc, nfiles, uptime() - start);
+  exit();
+}
@@ -12,9 +12,17 @@ struct superblock;
 
 // bio.c
 void            binit(void);
+struct buf*     bnew(void);
+void            bpin(struct buf*);
+void            bunpin(struct buf*);
+int             bcached(uint, uint);
+void            bprefetch(uint, uint);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwrite_start(struct buf*);
+void            bwait(struct buf*);
+void            get_bcache_info(char buf[]);
 
 // console.c
 void            consoleinit(void);
@@ -52,6 +60,10 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+void            iplace(struct inode*, struct inode*);
+void            dcremove(struct inode*, char*);
+void            ireadahead(struct inode*, uint, uint);
+int             icached(struct inode*, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 //int             inodes_counter();
@@ -62,6 +74,8 @@ void            print_inodes_info(void);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idesubmit(struct buf*, void (*)(struct buf*));
+void            ideawait(struct buf*);
 void            get_ide_info(char buf[]);
 
 
@@ -115,6 +129,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+void            kthread_create(char*, void (*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -5,6 +5,7 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
@@ -95,6 +96,41 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Before a read of n bytes at f->off, start reading the blocks
+// after it into the buffer cache if f is being read in order. The
+// window doubles with every sequential read, up to RAMAX blocks,
+// is halved when a block read ahead was evicted before it was
+// used, and closes on a seek. More is read only once the reader
+// is half way through what was read ahead. Caller holds f->ip->lock.
+static void
+readahead(struct file *f, int n)
+{
+  uint bn, last;
+
+  if(n <= 0 || f->ip->type != T_FILE)
+    return;
+  bn = f->off / BSIZE;
+  last = (f->off + n - 1) / BSIZE;
+  if(f->off != f->raoff){
+    f->rawin = 0;
+    f->raend = 0;
+  } else if(f->rawin == 0){
+    f->rawin = RAMIN;
+  } else if(bn < f->raend && !icached(f->ip, bn)){
+    f->rawin = f->rawin / 2 < RAMIN ? RAMIN : f->rawin / 2;
+  } else if(f->rawin < RAMAX){
+    f->rawin *= 2;
+  }
+  f->raoff = f->off + n;
+
+  if(f->rawin == 0 || f->raend > last + f->rawin / 2)
+    return;
+  if(f->raend < bn + 1)
+    f->raend = bn + 1;
+  ireadahead(f->ip, f->raend, last + 1 + f->rawin);
+  f->raend = last + 1 + f->rawin;
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
@@ -108,6 +144,7 @@ fileread(struct file *f, char *addr, int n)
   if(f->type == FD_INODE){
 
     ilock(f->ip);
+    readahead(f, n);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
@@ -130,11 +167,12 @@ filewrite(struct file *f, char *addr, int n)
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
+    // i-node, indirect blocks (two more where a write
+    // crosses from one to the next), allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    int max = ((MAXOPBLOCKS-1-1-2-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
@@ -8,6 +8,9 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint raoff;  // off where the next read would be sequential
+  uint rawin;  // readahead window, blocks; 0 while not sequential
+  uint raend;  // first block not yet read ahead
 };
 
 typedef struct proc_file {
@@ -30,7 +33,11 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+3];
+  uint mapbase;       // first block mapped by mapaddr, less NDIRECT
+  uint mapaddr;       // indirect block bmap used last, or 0
+  uint goal;          // where balloc looks first, or 0
+  uint rnext, rend;   // free blocks balloc keeps for this file
 
 };
 
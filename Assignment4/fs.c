@@ -25,6 +25,9 @@ int PROC_INUM;
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static int breserved(struct inode*, uint);
+static void dcinit(void);
+static void dcpurge(uint, uint);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -53,30 +56,151 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// balloc keeps an in-memory summary of the free bitmap, the
+// number of free blocks in each group of BGROUP blocks, so it
+// skips full parts of the disk without reading their bitmap.
+// It looks for a block after the one the file got last (or
+// near its directory's blocks, for a new file), and then keeps
+// the PREALLOC free blocks that follow for that file while it
+// is in use: other files allocate elsewhere unless the disk is
+// full. The reservation lives only in memory; the bitmap is
+// always the authority.
+
+#define BGROUP 64  // blocks per group of the free summary
+
+static struct {
+  struct spinlock lock;
+  ushort nfree[(FSSIZE + BGROUP - 1) / BGROUP];
+} bsum;
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+// Fill in the free summary from the bitmap.
+static void
+bsuminit(uint dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  int b, bi;
 
-  bp = 0;
+  if(sb.size > FSSIZE)
+    panic("bsuminit: file system too big");
+  initlock(&bsum.lock, "bsum");
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[(b + bi) / BGROUP]++;
+    brelse(bp);
+  }
+}
+
+static void
+bsumadd(uint b, int n)
+{
+  acquire(&bsum.lock);
+  bsum.nfree[b / BGROUP] += n;
+  release(&bsum.lock);
+}
+
+// Whether block b is free in bitmap block bp.
+static int
+bisfree(struct buf *bp, uint b)
+{
+  uint bi = b % BPB;
+
+  return (bp->data[bi/8] & (1 << (bi % 8))) == 0;
+}
+
+// Mark free block b of bitmap block bp in use.
+static void
+btake(struct buf *bp, uint b)
+{
+  uint bi = b % BPB;
+
+  bp->data[bi/8] |= 1 << (bi % 8);
+  log_write(bp);
+  bsumadd(b, -1);
+}
+
+// Where balloc should start looking for ip's next block: after
+// the one it got last, else after the last one the inode lists.
+static uint
+bgoal(struct inode *ip)
+{
+  int i;
+
+  if(ip->goal)
+    return ip->goal;
+  for(i = NDIRECT+2; i >= 0; i--)
+    if(ip->addrs[i])
+      return ip->addrs[i] + 1;
+  return 0;
+}
+
+// Take the first free block at or after goal, wrapping around,
+// that is not reserved by another file unless any will do; make
+// the free blocks after it ip's reservation. Returns 0 if none.
+static uint
+bfind(struct inode *ip, uint goal, int any)
+{
+  struct buf *bp;
+  uint g, b, end, e, n;
+  uint ngroup = (sb.size + BGROUP - 1) / BGROUP;
+
+  if(goal >= sb.size)
+    goal = 0;
+  for(n = 0; n <= ngroup; n++){
+    g = (goal / BGROUP + n) % ngroup;
+    if(bsum.nfree[g] == 0)
+      continue;
+    b = g * BGROUP;
+    end = b + BGROUP < sb.size ? b + BGROUP : sb.size;
+    if(n == 0)
+      b = goal;          // the rest of the goal's group now,
+    else if(n == ngroup)
+      end = goal;        // and its beginning last
+    bp = bread(ip->dev, BBLOCK(b, sb));  // BPB is a multiple of BGROUP
+    for(; b < end; b++){
+      if(!bisfree(bp, b) || (!any && breserved(ip, b)))
+        continue;
+      btake(bp, b);
+      // reserve what follows, within this bitmap block
+      for(e = b + 1; e < sb.size && e < b + 1 + PREALLOC && e % BPB != 0; e++)
+        if(!bisfree(bp, e) || breserved(ip, e))
+          break;
+      ip->rnext = b + 1;
+      ip->rend = e;
+      brelse(bp);
+      return b;
+    }
+    brelse(bp);
+  }
+  return 0;
+}
+
+// Allocate a zeroed disk block for ip.
+static uint
+balloc(struct inode *ip)
+{
+  struct buf *bp;
+  uint b = 0;
+
+  // the next block of ip's reservation, if still free
+  if(ip->rnext < ip->rend){
+    bp = bread(ip->dev, BBLOCK(ip->rnext, sb));
+    if(bisfree(bp, ip->rnext)){
+      b = ip->rnext++;
+      btake(bp, b);
+    } else {
+      ip->rnext = ip->rend = 0;
     }
     brelse(bp);
   }
-  panic("balloc: out of blocks");
+  if(b == 0 && (b = bfind(ip, bgoal(ip), 0)) == 0 &&
+     (b = bfind(ip, bgoal(ip), 1)) == 0)
+    panic("balloc: out of blocks");
+  ip->goal = b + 1;
+  bzero(ip->dev, b);
+  return b;
 }
 
 // Free a disk block.
@@ -94,9 +218,19 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  bsumadd(b, 1);
   brelse(bp);
 }
 
+// Allocate the blocks of the new inode ip near those of its
+// directory dp. Caller must hold ip->lock.
+void
+iplace(struct inode *ip, struct inode *dp)
+{
+  if(ip->goal == 0)
+    ip->goal = dp->addrs[0];
+}
+
 // Inodes.
 //
 // An inode describes a single unnamed file.
@@ -171,21 +305,42 @@ struct {
   struct inode inode[NINODE];
 } icache;
 
+// Whether block b is in the reservation of an inode other than ip.
+static int
+breserved(struct inode *ip, uint b)
+{
+  struct inode *p;
+
+  acquire(&icache.lock);
+  for(p = &icache.inode[0]; p < &icache.inode[NINODE]; p++){
+    if(p != ip && p->ref > 0 && b >= p->rnext && b < p->rend){
+      release(&icache.lock);
+      return 1;
+    }
+  }
+  release(&icache.lock);
+  return 0;
+}
+
 void
 iinit(int dev)
 {
   int i = 0;
   
   initlock(&icache.lock, "icache");
+  dcinit();
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&icache.inode[i].lock, "inode");
   }
 
   readsb(dev, &sb);
+  if(sb.bsize != BSIZE)
+    panic("iinit: file system block size is not BSIZE");
+  bsuminit(dev);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
+ inodestart %d bmap start %d bsize %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+          sb.bmapstart, sb.bsize);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -205,6 +360,7 @@ ialloc(uint dev, short type)
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
+      dcpurge(dev, inum);  // names cached in a directory it once was
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
@@ -269,6 +425,8 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->goal = 0;
+  ip->rnext = ip->rend = 0;
   release(&icache.lock);
 
   return ip;
@@ -307,6 +465,7 @@ ilock(struct inode *ip)
     ip->nlink = dip->nlink;
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    ip->mapaddr = 0;
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -351,6 +510,8 @@ iput(struct inode *ip)
 
   acquire(&icache.lock);
   ip->ref--;
+  if(ip->ref == 0)
+    ip->rnext = ip->rend = 0;  // give back the reservation
   release(&icache.lock);
 }
 
@@ -368,38 +529,95 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], the NDINDIRECT after
+// them in the blocks listed in block ip->addrs[NDIRECT+1],
+// and the last NTINDIRECT one level deeper still, under
+// ip->addrs[NDIRECT+2].
+
+// Return entry i of indirect block addr, allocating a block
+// for it if there is none.
+static uint
+bmap_slot(struct inode *ip, uint addr, uint i)
+{
+  uint *a;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    if(ip->goal == 0 && i > 0 && a[i-1])
+      ip->goal = a[i-1] + 1;   // appending after a reopen
+    a[i] = addr = balloc(ip);
+    log_write(bp);
+  }
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
+// Sequential access stays within one last-level indirect block
+// for NINDIRECT blocks, so bmap remembers the last one it used
+// rather than walking down to it from the inode each time.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, level, span, rel;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip);
     return addr;
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+  if(ip->mapaddr && bn - ip->mapbase < NINDIRECT)
+    return bmap_slot(ip, ip->mapaddr, bn - ip->mapbase);
+
+  // Which tree holds bn, and where in it.
+  rel = bn;
+  for(level = 1, span = NINDIRECT; level <= 3 && rel >= span; level++){
+    rel -= span;
+    span *= NINDIRECT;
+  }
+  if(level > 3)
+    panic("bmap: out of range");
+
+  // Load the indirect blocks down to the last level,
+  // allocating if necessary.
+  if((addr = ip->addrs[NDIRECT+level-1]) == 0)
+    ip->addrs[NDIRECT+level-1] = addr = balloc(ip);
+  for(; level > 1; level--){
+    span /= NINDIRECT;
+    addr = bmap_slot(ip, addr, rel / span);
+    rel %= span;
   }
+  ip->mapbase = bn - rel;
+  ip->mapaddr = addr;
+  return bmap_slot(ip, addr, rel);
+}
+
+// Free indirect block addr and the blocks under it, level
+// levels deep.
+static void
+itrunc_tree(struct inode *ip, uint addr, int level)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
 
-  panic("bmap: out of range");
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 1)
+      itrunc_tree(ip, a[j], level - 1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -410,9 +628,7 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -421,22 +637,42 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < 3; i++){
+    if(ip->addrs[NDIRECT+i]){
+      itrunc_tree(ip, ip->addrs[NDIRECT+i], i + 1);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  ip->mapaddr = 0;
 
   ip->size = 0;
   iupdate(ip);
 }
 
+// Start reading blocks [start, end) of ip into the buffer cache
+// without waiting for them. Blocks past the end of the file are
+// skipped. Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, uint start, uint end)
+{
+  uint nblocks = (ip->size + BSIZE - 1) / BSIZE;
+
+  if(end > nblocks)
+    end = nblocks;
+  for(; start < end; start++)
+    bprefetch(ip->dev, bmap(ip, start));
+}
+
+// Whether block bn of ip is in the buffer cache, or past the end
+// of the file. Caller must hold ip->lock.
+int
+icached(struct inode *ip, uint bn)
+{
+  if(bn >= (ip->size + BSIZE - 1) / BSIZE)
+    return 1;
+  return bcached(ip->dev, bmap(ip, bn));
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -501,7 +737,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(n > 0 && (off + n - 1) / BSIZE >= MAXFILE)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
@@ -519,6 +755,135 @@ writei(struct inode *ip, char *src, uint off, uint n)
   return n;
 }
 
+//PAGEBREAK!
+// Name cache
+//
+// Remembers what dirlookup found for a (directory, name): the
+// inode number and offset of the entry, or that there is none
+// (inum 0). A hit skips the readi scan of the directory, so
+// resolving a path seen before touches only cached inodes.
+// Entries of a directory change only with the directory locked:
+// dirlink records the new name, unlink forgets the old one and
+// ialloc drops everything cached under a reused inode number.
+// Device directories are never cached.
+//
+// The cache is set associative: a name hashes to a set of
+// DCWAYS entries and replaces the one used longest ago.
+
+#define DCWAYS 4
+
+struct dentry {
+  uint dev;
+  uint dinum;      // directory; 0 if the entry is free
+  char name[DIRSIZ];
+  uint inum;       // 0 if the directory has no such name
+  uint off;        // of the directory entry
+  uint lastuse;
+};
+
+static struct {
+  struct spinlock lock;
+  uint clock;
+  struct dentry ent[NDCACHE];
+} dcache;
+
+static void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dentry*
+dcset(uint dev, uint dinum, char *name)
+{
+  uint h = dev * 31 + dinum;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return &dcache.ent[h % (NDCACHE / DCWAYS) * DCWAYS];
+}
+
+// Entry for name in dp, or 0. Caller holds dcache.lock.
+static struct dentry*
+dcfind(struct inode *dp, char *name)
+{
+  struct dentry *d, *set = dcset(dp->dev, dp->inum, name);
+
+  for(d = set; d < set + DCWAYS; d++)
+    if(d->dinum == dp->inum && d->dev == dp->dev && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Look name up in the cache. Returns 1 and sets *pinum (0 for a
+// name known not to exist) and *poff on a hit, 0 on a miss.
+static int
+dcget(struct inode *dp, char *name, uint *pinum, uint *poff)
+{
+  struct dentry *d;
+
+  if(dp->type != T_DIR)
+    return 0;
+  acquire(&dcache.lock);
+  if((d = dcfind(dp, name)) != 0){
+    d->lastuse = ++dcache.clock;
+    *pinum = d->inum;
+    *poff = d->off;
+  }
+  release(&dcache.lock);
+  return d != 0;
+}
+
+// Record that name in dp is inum at off, or is absent if inum is 0.
+static void
+dcput(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d, *set;
+
+  if(dp->type != T_DIR)
+    return;
+  acquire(&dcache.lock);
+  if((d = dcfind(dp, name)) == 0){
+    set = dcset(dp->dev, dp->inum, name);
+    for(d = set; d < set + DCWAYS && d->dinum != 0; d++)
+      ;
+    if(d == set + DCWAYS){
+      struct dentry *e;
+      for(d = e = set; e < set + DCWAYS; e++)
+        if(e->lastuse < d->lastuse)
+          d = e;
+    }
+    d->dev = dp->dev;
+    d->dinum = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+  }
+  d->inum = inum;
+  d->off = off;
+  d->lastuse = ++dcache.clock;
+  release(&dcache.lock);
+}
+
+// The entry for name in dp was cleared. Caller holds dp->lock.
+void
+dcremove(struct inode *dp, char *name)
+{
+  dcput(dp, name, 0, 0);
+}
+
+// Forget all names cached in directory inum.
+static void
+dcpurge(uint dev, uint dinum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < &dcache.ent[NDCACHE]; d++)
+    if(d->dinum == dinum && d->dev == dev)
+      d->dinum = 0;
+  release(&dcache.lock);
+}
+
 //PAGEBREAK!
 // Directories
 
@@ -540,6 +905,14 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR && !IS_DEV_DIR(dp))
     panic("dirlookup not DIR");
 
+  if(dcget(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size || dp->type == T_DEV ; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de)) {
       if (dp->type == T_DEV)
@@ -554,6 +927,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcput(dp, name, inum, off);
       ip = iget(dp->dev, inum);
       if (ip->valid == 0 && dp->type == T_DEV && devsw[dp->major].iread) {
         devsw[dp->major].iread(dp, ip);
@@ -562,6 +936,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
     }
   }
 
+  dcput(dp, name, 0, 0);
   return 0;
 }
 
@@ -594,6 +969,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcput(dp, name, inum, off);
 
   return 0;
 }
@@ -0,0 +1,79 @@
+// Sequential write and read throughput of one file, for comparing
+// block sizes. Each build has one BSIZE, so make a row per size:
+//
+//   make clean; make qemu BSIZE=512     (then 1024, 2048, 4096)
+//   $ fsbench
+//
+// and put the rows together into a table. The read pass reopens
+// the file; blocks still in the buffer cache are not read again.
+//
+// usage: fsbench [kbytes]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+#define CHUNK 4096
+#define BENCHFILE "fsbench.dat"
+
+char buf[CHUNK];
+
+// KB per second, from ticks of 10ms
+int
+rate(int kb, int ticks)
+{
+  if(ticks < 1)
+    ticks = 1;
+  return kb * 100 / ticks;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int kb = 256, fd, i, n, start, wt, rt;
+
+  if(argc > 1)
+    kb = atoi(argv[1]);
+  if(kb < 4)
+    kb = 4;
+  n = kb * 1024 / CHUNK;
+  for(i = 0; i < CHUNK; i++)
+    buf[i] = i;
+
+  unlink(BENCHFILE);
+  start = uptime();
+  if((fd = open(BENCHFILE, O_CREATE | O_RDWR)) < 0){
+    printf(1, "fsbench: cannot create %s\n", BENCHFILE);
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if(write(fd, buf, CHUNK) != CHUNK){
+      printf(1, "fsbench: write failed after %d KB\n", i * CHUNK / 1024);
+      exit();
+    }
+  }
+  close(fd);
+  wt = uptime() - start;
+
+  start = uptime();
+  if((fd = open(BENCHFILE, O_RDONLY)) < 0){
+    printf(1, "fsbench: cannot open %s\n", BENCHFILE);
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if(read(fd, buf, CHUNK) != CHUNK){
+      printf(1, "fsbench: read failed after %d KB\n", i * CHUNK / 1024);
+      exit();
+    }
+  }
+  close(fd);
+  rt = uptime() - start;
+  unlink(BENCHFILE);
+
+  printf(1, "bsize  KB  write ticks  write KB/s  read ticks  read KB/s\n");
+  printf(1, "%d  %d  %d  %d  %d  %d\n", BSIZE, n * CHUNK / 1024,
+         wt, rate(n * CHUNK / 1024, wt), rt, rate(n * CHUNK / 1024, rt));
+  exit();
+}
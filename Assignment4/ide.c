@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code. Uses bus-master DMA on a PCI IDE controller
+// such as the PIIX, and programmed I/O when there is none.
 
 #include "types.h"
 #include "defs.h"
@@ -24,15 +25,55 @@
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+#define IDE_CMD_SETMULT 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+
+// Bus-master registers of the primary channel, at BAR4 of the
+// controller's PCI function.
+#define BM_CMD        0     // command
+#define BM_STATUS     2     // status
+#define BM_PRDT       4     // physical address of the PRD table
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // the device writes memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+#define IDE_MULT      16   // sectors per interrupt with RDMUL/WRMUL
+#define IDE_MAXSECT   64   // most sectors merged into one command
+#define IDE_EXPIRE    10   // ticks a request waits before it goes first
+
+// idequeue holds the bufs waiting for the disk, sorted by (dev,
+// blockno) and linked through qnext. The next command starts at the
+// first buf after the last one the disk moved to (C-LOOK), unless a
+// buf waited more than IDE_EXPIRE ticks: then the oldest goes first.
+// Bufs of contiguous blocks going the same way are merged into one
+// command; ideactive chains the bufs of the command in progress.
+// You must hold idelock while manipulating the queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *ideactive;
+static int nsect;                 // sectors in the active command
+static int nsectdone;             // sectors moved so far
+static uint headdev, headblock;   // where the last command ended
+static int idemult = 1;           // sectors per DRQ block
+static ushort bmbase;             // bus-master registers, or 0 for PIO
+
+// Physical region descriptor: one buf's data for the DMA engine.
+// The table must not cross 64KB and regions must not cross 64KB;
+// bio.c never lets a buf cross a page.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+#define PRD_EOT 0x8000
+static struct prd prdt[IDE_MAXSECT] __attribute__((aligned(IDE_MAXSECT*sizeof(struct prd))));
 
 static int havedisk1;
-static void idestart(struct buf*);
+static void idestart(void);
+static void idecmd(void);
 
 // Wait for IDE disk to become ready.
 static int
@@ -47,6 +88,46 @@ idewait(int checkerr)
   return 0;
 }
 
+static uint
+pciread(int bus, int dev, int func, int off)
+{
+  outl(0xcf8, 0x80000000 | (bus<<16) | (dev<<11) | (func<<8) | (off&0xfc));
+  return inl(0xcfc);
+}
+
+static void
+pciwrite(int bus, int dev, int func, int off, uint v)
+{
+  outl(0xcf8, 0x80000000 | (bus<<16) | (dev<<11) | (func<<8) | (off&0xfc));
+  outl(0xcfc, v);
+}
+
+// Find a bus-master IDE controller on PCI bus 0 and let it master
+// the bus.  Returns the I/O base of its bus-master registers, or 0.
+static ushort
+idedmaprobe(void)
+{
+  int dev, func;
+  uint class, bar;
+
+  for(dev = 0; dev < 32; dev++){
+    for(func = 0; func < 8; func++){
+      if((pciread(0, dev, func, 0) & 0xffff) == 0xffff)
+        continue;
+      class = pciread(0, dev, func, 0x08);
+      // mass storage, IDE, bus-master capable
+      if((class >> 16) != 0x0101 || !(class & 0x8000))
+        continue;
+      bar = pciread(0, dev, func, 0x20);
+      if(!(bar & 1) || (bar & ~3) == 0)
+        continue;
+      pciwrite(0, dev, func, 0x04, pciread(0, dev, func, 0x04) | 0x5);
+      return bar & 0xfffc;
+    }
+  }
+  return 0;
+}
+
 void
 ideinit(void)
 {
@@ -67,35 +148,143 @@ ideinit(void)
 
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  // Move IDE_MULT sectors per interrupt if the disks can.
+  outb(0x3f6, 2);  // no interrupt for this one
+  for(i = 0; i <= havedisk1; i++){
+    outb(0x1f6, 0xe0 | (i<<4));
+    outb(0x1f2, IDE_MULT);
+    outb(0x1f7, IDE_CMD_SETMULT);
+    if(idewait(1) < 0)
+      break;
+  }
+  if(i > havedisk1)
+    idemult = IDE_MULT;
+  outb(0x1f6, 0xe0 | (0<<4));
+  outb(0x3f6, 0);
+
+  if((bmbase = idedmaprobe()) != 0){
+    outl(bmbase + BM_PRDT, V2P(prdt));
+    outb(bmbase + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+  }
 }
 
-// Start the request for b.  Caller must hold idelock.
+static int
+sectors_per_block(void)
+{
+  return BSIZE / SECTOR_SIZE;
+}
+
+// Whether a comes before b on the disk.
+static int
+before(uint adev, uint ablock, uint bdev, uint bblock)
+{
+  return adev < bdev || (adev == bdev && ablock < bblock);
+}
+
+// Move the next DRQ block of the active command, up to idemult
+// sectors, between the disk and the bufs.
 static void
-idestart(struct buf *b)
+idepio(int write)
 {
-  if(b == 0)
+  struct buf *b;
+  uchar *data;
+  int i, n, spb = sectors_per_block();
+
+  n = nsect - nsectdone < idemult ? nsect - nsectdone : idemult;
+  for(; n > 0; n--, nsectdone++){
+    b = ideactive;
+    for(i = nsectdone / spb; i > 0; i--)
+      b = b->qnext;
+    data = b->data + (nsectdone % spb) * SECTOR_SIZE;
+    if(write)
+      outsl(0x1f0, data, SECTOR_SIZE/4);
+    else
+      insl(0x1f0, data, SECTOR_SIZE/4);
+  }
+}
+
+// Start the next command from idequeue.  Caller must hold idelock.
+static void
+idestart(void)
+{
+  struct buf *b, *last, **pp, **first;
+  int spb = sectors_per_block();
+  int write;
+
+  if(idequeue == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+
+  first = 0;
+  for(pp = &idequeue; *pp; pp = &(*pp)->qnext)
+    if(ticks - (*pp)->qtime > IDE_EXPIRE &&
+       (first == 0 || (*pp)->qtime < (*first)->qtime))
+      first = pp;
+  if(first == 0){
+    for(pp = &idequeue; *pp; pp = &(*pp)->qnext)
+      if(!before((*pp)->dev, (*pp)->blockno, headdev, headblock))
+        break;
+    first = *pp ? pp : &idequeue;
+  }
+
+  // take the first buf and the contiguous ones after it
+  last = ideactive = *first;
+  *first = last->qnext;
+  write = last->flags & B_DIRTY;
+  nsect = spb;
+  while((b = *first) != 0 && b->dev == last->dev &&
+        b->blockno == last->blockno + 1 && (b->flags & B_DIRTY) == write &&
+        nsect + spb <= IDE_MAXSECT){
+    *first = b->qnext;
+    last->qnext = b;
+    last = b;
+    nsect += spb;
+  }
+  last->qnext = 0;
+  headdev = last->dev;
+  headblock = last->blockno + 1;
+
+  if(last->blockno >= FSSIZE)
     panic("incorrect blockno");
-  int sector_per_block =  BSIZE/SECTOR_SIZE;
-  int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  idecmd();
+}
+
+// Issue the command for the bufs on ideactive.
+static void
+idecmd(void)
+{
+  struct buf *b;
+  int i, sector, write, readcmd, writecmd;
 
-  if (sector_per_block > 7) panic("idestart");
+  write = ideactive->flags & B_DIRTY;
+  nsectdone = 0;
+  sector = ideactive->blockno * sectors_per_block();
+  readcmd = (idemult == 1) ? IDE_CMD_READ : IDE_CMD_RDMUL;
+  writecmd = (idemult == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsect);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+  outb(0x1f6, 0xe0 | ((ideactive->dev&1)<<4) | ((sector>>24)&0x0f));
+  if(bmbase){
+    // one region per buf
+    for(i = 0, b = ideactive; b; b = b->qnext, i++){
+      prdt[i].addr = V2P(b->data);
+      prdt[i].len = BSIZE;
+      prdt[i].flags = b->qnext ? 0 : PRD_EOT;
+    }
+    outb(bmbase + BM_CMD, write ? 0 : BM_CMD_READ);
+    outb(bmbase + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+    outb(0x1f7, write ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(bmbase + BM_CMD, (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+  } else if(write){
+    outb(0x1f7, writecmd);
+    idepio(1);
   } else {
-    outb(0x1f7, read_cmd);
+    outb(0x1f7, readcmd);
   }
 }
 
@@ -104,38 +293,72 @@ void
 ideintr(void)
 {
   struct buf *b;
+  int write, st;
 
-  // First queued buffer is the active request.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if(ideactive == 0){
+    release(&idelock);
+    return;
+  }
+  write = ideactive->flags & B_DIRTY;
+
+  if(bmbase){
+    // The DMA engine moved the whole command.
+    outb(bmbase + BM_CMD, 0);
+    st = inb(bmbase + BM_STATUS);
+    outb(bmbase + BM_STATUS, st | BM_ST_ERR | BM_ST_INTR);
+    if((st & BM_ST_ERR) || (inb(0x1f7) & (IDE_DF|IDE_ERR))){
+      // give up on DMA and redo the command with PIO
+      cprintf("ide: DMA failed, using PIO\n");
+      bmbase = 0;
+      idecmd();
+      release(&idelock);
+      return;
+    }
+    nsectdone = nsect;
+  } else if(!write){
+    // Move the next DRQ block; a write interrupts after each one.
+    if(idewait(1) >= 0)
+      idepio(0);
+    else
+      nsectdone = nsect;
+  } else if(nsectdone < nsect){
+    idepio(1);
+    release(&idelock);
+    return;
+  }
+  if(nsectdone < nsect){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
-
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // Finish every buf of the command.
+  while((b = ideactive) != 0){
+    ideactive = b->qnext;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->iodone)
+      b->iodone(b);
+    else
+      wakeup(b);
+  }
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
-    idestart(idequeue);
+    idestart();
 
   release(&idelock);
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
+// Queue b to be synced with disk and return at once.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Then done(b) is called from the interrupt handler with idelock
+// held, so it must not sleep; if done is 0, ideawait(b) waits.
 void
-iderw(struct buf *b)
+idesubmit(struct buf *b, void (*done)(struct buf*))
 {
   struct buf **pp;
 
@@ -148,46 +371,67 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
+  // Insert b into idequeue in block order.
+  b->iodone = done;
+  b->qtime = ticks;
   for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
+    if(before(b->dev, b->blockno, (*pp)->dev, (*pp)->blockno))
+      break;
+  b->qnext = *pp;
   *pp = b;
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(ideactive == 0)
+    idestart();
 
-  // Wait for request to finish.
+  release(&idelock);
+}
+
+// Wait for a buf queued by idesubmit without done to finish.
+void
+ideawait(struct buf *b)
+{
+  acquire(&idelock);
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
-
-
   release(&idelock);
 }
 
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  idesubmit(b, 0);
+  ideawait(b);
+}
+
 void
 get_ide_info(char buf[]) {
   uint blocks_buf[1000];
   int read_counter = 0;
   int write_counter = 0;
+  struct buf *lists[2], *cur_block;
+  int i;
   acquire(&idelock);
-  struct buf *cur_block = idequeue;
+  lists[0] = ideactive;
+  lists[1] = idequeue;
 
   memset(blocks_buf, 0, sizeof(blocks_buf));
   uint *p = blocks_buf;
 
-  while (cur_block){
-    if(!(cur_block->flags & B_VALID))
-      read_counter++;
-    if (cur_block->flags & B_DIRTY)
-      write_counter++;
+  for(i = 0; i < 2; i++){
+    for(cur_block = lists[i]; cur_block; cur_block = cur_block->qnext){
+      if(!(cur_block->flags & B_VALID))
+        read_counter++;
+      if (cur_block->flags & B_DIRTY)
+        write_counter++;
 
-    *p++ = cur_block->dev;
-    *p++ = cur_block->blockno;
-
-    cur_block = cur_block->qnext;
+      *p++ = cur_block->dev;
+      *p++ = cur_block->blockno;
+    }
   }
     release(&idelock);
 
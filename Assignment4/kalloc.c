@@ -17,10 +17,22 @@ struct run {
   struct run *next;
 };
 
+// Every CPU keeps a magazine of up to KMAGSIZE free pages, so most
+// calls to kalloc and kfree do not touch kmem.lock. Pages move between
+// a magazine and the global freelist KMAGSIZE/2 at a time. Only the
+// owner takes the lock of a magazine, unless some CPU is out of free
+// pages and looks in the magazines of the others.
+struct kmag {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+};
+
 struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  struct kmag mag[NCPU];
 } kmem;
 
 // Initialization happens in two phases.
@@ -31,7 +43,11 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.mag[i].lock, "kmag");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -52,6 +68,59 @@ freerange(void *vstart, void *vend)
     kfree(p);
 }
 //PAGEBREAK: 21
+// Move up to n pages from the global freelist to m.
+// Must hold m->lock.
+static void
+mag_refill(struct kmag *m, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(n-- > 0 && (r = kmem.freelist) != 0){
+    kmem.freelist = r->next;
+    r->next = m->freelist;
+    m->freelist = r;
+    m->n++;
+  }
+  release(&kmem.lock);
+}
+
+// Move n pages from m to the global freelist.
+// Must hold m->lock.
+static void
+mag_drain(struct kmag *m, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(n-- > 0 && (r = m->freelist) != 0){
+    m->freelist = r->next;
+    m->n--;
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+  }
+  release(&kmem.lock);
+}
+
+// Take a page from any magazine, for when the magazine of this CPU
+// and the global freelist are both empty. Returns 0 if there is none.
+static struct run*
+mag_steal(void)
+{
+  struct kmag *m;
+  struct run *r = 0;
+
+  for(m = kmem.mag; m < &kmem.mag[NCPU] && r == 0; m++){
+    acquire(&m->lock);
+    if((r = m->freelist) != 0){
+      m->freelist = r->next;
+      m->n--;
+    }
+    release(&m->lock);
+  }
+  return r;
+}
+
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
@@ -60,20 +129,33 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct kmag *m;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+#ifdef KDEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+
+  if(!kmem.use_lock){
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    return;
+  }
+
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  acquire(&m->lock);
+  r->next = m->freelist;
+  m->freelist = r;
+  if(++m->n > KMAGSIZE)
+    mag_drain(m, KMAGSIZE / 2);
+  release(&m->lock);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +165,28 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kmag *m;
+
+  if(!kmem.use_lock){
+    if((r = kmem.freelist) != 0)
+      kmem.freelist = r->next;
+    return (char*)r;
+  }
+
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n == 0)
+    mag_refill(m, KMAGSIZE / 2);
+  if((r = m->freelist) != 0){
+    m->freelist = r->next;
+    m->n--;
+  }
+  release(&m->lock);
+  popcli();
+
+  if(r == 0)
+    r = mag_steal();
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
   return (char*)r;
 }
-
@@ -20,64 +20,128 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// A transaction groups the system calls of many processes:
+// it stays open until the log cannot take another op or it
+// is LOGTICKS old. The last end_op() then commits it; the
+// "logd" thread commits transactions no op ends.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
-// Log appends are synchronous.
-
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+//   header block, containing the tail slot and block #s
+//     for block A, B, C, ...
+//   slots 0 .. size-2, used as a circle; block A is in the
+//     tail slot, block B in the one after it, ...
+// Committing a transaction writes its blocks to the slots
+// after the committed ones and then the header; it does not
+// wait for them to reach their home locations. logd copies
+// committed blocks home in the background (a checkpoint) and
+// then moves the tail past them, freeing their slots. Until
+// then, their cached bufs stay pinned, so that nobody reads
+// the stale home copy.
+
+#define LOGBATCH 16   // blocks queued at once by write_log and install_trans
+
+// Contents of the header block: the committed blocks not yet
+// installed. log.lh only ever describes a header that is on the
+// disk: write_head() changes it after the write. So a checkpoint
+// never installs a block whose commit is not durable, and a commit
+// never reuses a slot the header on disk still lists.
 struct logheader {
   int n;
+  int tail;
   int block[LOGSIZE];
 };
 
 struct log {
   struct spinlock lock;
+  struct sleeplock headlock; // orders writes of the header block
   int start;
-  int size;
+  int size;        // blocks in the on-disk log, header included
+  uint opened;     // ticks when the transaction got its first block
+  uint installed;  // ticks of the last checkpoint
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int waiting;     // begin_op() callers waiting for log space
   int dev;
-  struct logheader lh;
+  struct logheader lh;        // committed blocks, as on disk
+  struct buf *lhbuf[LOGSIZE]; // their cached bufs, pinned
+  struct {                    // the open transaction
+    int n;
+    int block[LOGSIZE];
+    struct buf *buf[LOGSIZE];
+  } txn;
 };
 struct log log;
 
+// Private bufs install_trans() copies log blocks into: writing
+// them home through the cached bufs would clobber newer data.
+static struct buf *ckbuf[LOGBATCH];
+
 static void recover_from_log(void);
 static void commit();
+static void logd(void);
 
 void
 initlog(int dev)
 {
+  int i;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
   initlock(&log.lock, "log");
+  initsleeplock(&log.headlock, "loghead");
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
   log.dev = dev;
+  if(log.size - 1 > LOGSIZE)
+    panic("initlog: log too big");
+  for (i = 0; i < LOGBATCH; i++)
+    if ((ckbuf[i] = bnew()) == 0)
+      panic("initlog: out of memory");
   recover_from_log();
+  kthread_create("logd", logd);
+}
+
+// Disk block of log slot s.
+static int
+slot(int s)
+{
+  return log.start + 1 + s % (log.size - 1);
 }
 
-// Copy committed blocks from log to their home location
+// Copy the n committed blocks from the slots after tail to
+// their home locations. A block logged again later in the
+// same run is only copied from the last of its slots.
 static void
-install_trans(void)
+install_trans(int tail, int n, int *block)
 {
-  int tail;
+  struct buf *cb[LOGBATCH];
+  int i, j, k;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  for (i = 0; i < n; ) {
+    for (k = 0; i < n && k < LOGBATCH; i++) {
+      for (j = i + 1; j < n && block[j] != block[i]; j++)
+        ;
+      if (j < n)
+        continue;   // superseded
+      struct buf *lbuf = bread(log.dev, slot(tail + i)); // read log block
+      cb[k] = ckbuf[k];
+      acquiresleep(&cb[k]->lock);
+      cb[k]->dev = log.dev;
+      cb[k]->blockno = block[i];
+      cb[k]->flags = B_DIRTY;
+      memmove(cb[k]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+      idesubmit(cb[k], 0);  // write dst to disk
+      k++;
+    }
+    for (j = 0; j < k; j++) {
+      ideawait(cb[j]);
+      releasesleep(&cb[j]->lock);
+    }
   }
 }
 
@@ -89,36 +153,89 @@ read_head(void)
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
   log.lh.n = lh->n;
+  log.lh.tail = lh->tail;
   for (i = 0; i < log.lh.n; i++) {
     log.lh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write a header to disk listing the committed blocks but the
+// first drop of them, which a checkpoint installed, followed by
+// the open transaction's blocks if add is set. Then make log.lh
+// match it. With add, this is the true point at which a
+// transaction commits.
 static void
-write_head(void)
+write_head(int drop, int add)
 {
+  acquiresleep(&log.headlock);  // only we change log.lh
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
+  acquire(&log.lock);
+  hb->tail = (log.lh.tail + drop) % (log.size - 1);
+  hb->n = 0;
+  for (i = drop; i < log.lh.n; i++)
+    hb->block[hb->n++] = log.lh.block[i];
+  for (i = 0; add && i < log.txn.n; i++)
+    hb->block[hb->n++] = log.txn.block[i];
+  release(&log.lock);
+  bwrite(buf);
+
+  acquire(&log.lock);
+  log.lh.tail = hb->tail;
+  log.lh.n -= drop;
   for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+    log.lh.block[i] = log.lh.block[i + drop];
+    log.lhbuf[i] = log.lhbuf[i + drop];
   }
-  bwrite(buf);
+  for (i = 0; add && i < log.txn.n; i++) {
+    log.lh.block[log.lh.n] = log.txn.block[i];
+    log.lhbuf[log.lh.n] = log.txn.buf[i];
+    log.lh.n++;
+  }
+  if (add)
+    log.txn.n = 0;
+  release(&log.lock);
   brelse(buf);
+  releasesleep(&log.headlock);
 }
 
 static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  install_trans(log.lh.tail, log.lh.n, log.lh.block); // if committed, copy from log to disk
+  write_head(log.lh.n, 0); // clear the log
+}
+
+// Copy the committed blocks home and free their slots.
+static void
+checkpoint(void)
+{
+  static struct buf *pinned[LOGSIZE];  // only logd checkpoints
+  static int block[LOGSIZE];
+  int i, tail, n;
+
+  // commits only add blocks after these
+  acquire(&log.lock);
+  tail = log.lh.tail;
+  n = log.lh.n;
+  for (i = 0; i < n; i++) {
+    block[i] = log.lh.block[i];
+    pinned[i] = log.lhbuf[i];
+  }
+  release(&log.lock);
+
+  install_trans(tail, n, block);
+  write_head(n, 0);    // Erase the installed blocks from the log
+
+  for (i = 0; i < n; i++)
+    bunpin(pinned[i]);
+  acquire(&log.lock);
+  log.installed = ticks;
+  wakeup(&log);   // their slots are free
+  release(&log.lock);
 }
 
 // called at the start of each FS system call.
@@ -129,9 +246,12 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.txn.n + (log.outstanding+1)*MAXOPBLOCKS > log.size - 1 - log.lh.n){
+      // this op might exhaust log space; wait for commit
+      // or checkpoint.
+      log.waiting++;
       sleep(&log, &log.lock);
+      log.waiting--;
     } else {
       log.outstanding += 1;
       release(&log.lock);
@@ -140,20 +260,43 @@ begin_op(void)
   }
 }
 
+// Whether the open transaction should commit as soon as
+// no op is in it.
+static int
+commit_due(void)
+{
+  return log.txn.n > 0 &&
+    (log.txn.n + MAXOPBLOCKS > log.size - 1 - log.lh.n ||
+     ticks - log.opened >= LOGTICKS);
+}
+
+// Commit the open transaction. Called with log.lock held and
+// no outstanding op; returns with it held.
+static void
+group_commit(void)
+{
+  log.committing = 1;
+  release(&log.lock);
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and the transaction is full or old enough.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.outstanding == 0 && commit_due()){
+    group_commit();
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -161,48 +304,75 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
+
+// The log writer. Commits transactions that stay open LOGTICKS
+// with no op ending in them, and checkpoints when the log is
+// half full, when begin_op() waits for space, or every LOGTICKS.
+static void
+logd(void)
+{
+  int ck;
+
+  for(;;){
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
     acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+    if(log.outstanding == 0 && !log.committing && commit_due())
+      group_commit();
+    ck = log.lh.n > 0 && (log.waiting > 0 || log.lh.n >= (log.size - 1) / 2 ||
+                          ticks - log.installed >= LOGTICKS);
     release(&log.lock);
+    if(ck)
+      checkpoint();
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to the log slots after head.
 static void
-write_log(void)
+write_log(int head)
 {
-  int tail;
+  struct buf *to[LOGBATCH];
+  int tail, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = 0; tail < log.txn.n; tail += n) {
+    n = log.txn.n - tail < LOGBATCH ? log.txn.n - tail : LOGBATCH;
+    for (i = 0; i < n; i++) {
+      to[i] = bread(log.dev, slot(head+tail+i)); // log block
+      struct buf *from = bread(log.dev, log.txn.block[tail+i]); // cache block
+      memmove(to[i]->data, from->data, BSIZE);
+      bwrite_start(to[i]);  // write the log
+      brelse(from);
+    }
+    for (i = 0; i < n; i++) {
+      bwait(to[i]);
+      brelse(to[i]);
+    }
   }
 }
 
+// Write the open transaction to the log. logd installs it
+// later; its bufs stay pinned until then.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  int head;
+
+  if (log.txn.n > 0) {
+    // checkpoints only free slots before head
+    acquire(&log.lock);
+    head = log.lh.tail + log.lh.n;
+    release(&log.lock);
+
+    write_log(head);  // Write modified blocks from cache to log
+    write_head(0, 1); // Write header to disk -- the real commit
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
-// Record the block number and pin in the cache with B_DIRTY.
+// Record the block number and pin it in the cache.
 // commit()/write_log() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
@@ -215,20 +385,23 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorbtion
+  for (i = 0; i < log.txn.n; i++) {
+    if (log.txn.block[i] == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
-    log.lh.n++;
-  b->flags |= B_DIRTY; // prevent eviction
+  if (i == log.txn.n){
+    if (i >= LOGSIZE || log.txn.n + log.lh.n >= log.size - 1)
+      panic("too big a transaction");
+    if (i == 0)
+      log.opened = ticks;
+    log.txn.block[i] = b->blockno;
+    log.txn.buf[i] = b;
+    log.txn.n++;
+    bpin(b);   // prevent eviction
+  }
   release(&log.lock);
 }
-
@@ -1,6 +1,7 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
+#define KMAGSIZE     64  // free pages kalloc keeps on each CPU
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
@@ -8,7 +9,15 @@
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      125  // max data blocks in on-disk log, as the header holds
+#define LOGTICKS     30  // ticks a transaction may stay open
+#define NBUF         (LOGSIZE+MAXOPBLOCKS*3)  // fewest buffers in the disk block cache
+#define NBUFMAX      2048  // most buffers in the disk block cache
+#define BCACHEFRAC     64  // binit gives 1/BCACHEFRAC of memory to buffers
+#define NBUCKET        61  // hash buckets of the disk block cache
+#define RAMIN         4  // blocks read ahead when a file is first read in order
+#define RAMAX        32  // most blocks read ahead of a sequential reader
+#define PREALLOC      8  // free blocks kept for a growing file
+#define NDCACHE      256  // directory entries in the name cache
+#define FSSIZE       2000  // size of file system in blocks
 
@@ -70,9 +70,10 @@ myproc(void) {
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
 // state required to run in the kernel.
-// Otherwise return 0.
+// Otherwise return 0. A kernel thread gets pid 0: it is
+// no user process, and init stays pid 1.
 static struct proc*
-allocproc(void)
+allocproc(int kthread)
 {
   struct proc *p;
   char *sp;
@@ -88,7 +89,7 @@ allocproc(void)
 
 found:
   p->state = EMBRYO;
-  p->pid = nextpid++;
+  p->pid = kthread ? 0 : nextpid++;
 
   release(&ptable.lock);
 
@@ -113,7 +114,8 @@ found:
   memset(p->context, 0, sizeof *p->context);
   p->context->eip = (uint)forkret;
 
-  add_pid_entry(p);
+  if(!kthread)
+    add_pid_entry(p);
 
   return p;
 }
@@ -126,7 +128,7 @@ userinit(void)
   struct proc *p;
   extern char _binary_initcode_start[], _binary_initcode_size[];
 
-  p = allocproc();
+  p = allocproc(0);
   
   initproc = p;
   if((p->pgdir = setupkvm()) == 0)
@@ -188,7 +190,7 @@ fork(void)
   struct proc *curproc = myproc();
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
 
@@ -417,6 +419,36 @@ forkret(void)
   // Return to "caller", actually trapret (see allocproc).
 }
 
+// A kernel thread's very first scheduling by scheduler() will
+// swtch here. "Return" to the thread's function (see kthread_create).
+static void
+kthreadret(void)
+{
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+}
+
+// Start a kernel thread running fn, which must not return. It has no
+// user memory and never leaves the kernel.
+void
+kthread_create(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc(1)) == 0)
+    panic("kthread_create");
+  if((p->pgdir = setupkvm()) == 0)
+    panic("kthread_create: out of memory");
+  memset(p->tf, 0, sizeof(*p->tf));
+  p->context->eip = (uint)kthreadret;
+  *(uint*)(p->context + 1) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -39,7 +39,7 @@ char *P_STATES[] = {
 };
 
 // array holding all dirents under /proc
-#define NUM_DEFAULT_SUBPROCS 5
+#define NUM_DEFAULT_SUBPROCS 6
 struct dirent PROC_ENTRIES[NUM_DEFAULT_SUBPROCS + NPROC];
 struct dirent *PID_PROC_ENTRIES = PROC_ENTRIES + NUM_DEFAULT_SUBPROCS;
 uint num_procs = 0;
@@ -117,6 +117,9 @@ set_dev_size(struct inode *ip) {
   else if (inum == INODEINFO_INUM)
     ip->size = 200; //TODO
 
+  else if (inum == BCACHEINFO_INUM)
+    ip->size = 100;
+
   else if (inum == PROC_INUM)
     ip->size = EMPTY_DIR_SZ + (NUM_DEFAULT_SUBPROCS + num_procs) * dirent_s;
 }
@@ -214,6 +217,18 @@ int fill_buffer_file_stat(char *dst, int off, int n, proc_file *pf, struct inode
 }
 
 
+/*
+ * Read handler for bcacheinfo dev file
+ * */
+int fill_buffer_bcache_info(char *dst, int off, int n, proc_file *pf, struct inode *ip) {
+  char bcache_info[100];
+  memset(bcache_info, 0, 100);
+  get_bcache_info(bcache_info);
+
+  return set_bytes_to_read(dst, bcache_info, off, n, sizeof(bcache_info));
+}
+
+
 /*
  * Read handler for /proc/<PID>/name dev file
  * */
@@ -304,7 +319,8 @@ int fill_buffer_pid(char *dst, int off, int n, proc_file *pf, struct inode *ip)
  * 1. ideinfo - dev file
  * 2. filestat - dev file
  * 3. inodeinfo - dev dir
- * 4-... <PID> - dev dir for each pid of proc in ptable
+ * 4. bcacheinfo - dev file
+ * 5-... <PID> - dev dir for each pid of proc in ptable
  * */
 int fill_buffer_proc(char *dst, int off, int n, proc_file *pf, struct inode *ip) {
   init_proc_dev_subs();
@@ -423,6 +439,9 @@ void init_default_proc_subinodes() {
 
   update_dirent_entry(777, &PROC_ENTRIES[4], "inodeinfo", 1);
   add_inumproc_entry(777, (proc_file) {fill_buffer_inode_info, 0});
+
+  update_dirent_entry(666, &PROC_ENTRIES[5], "bcacheinfo", 1);
+  add_inumproc_entry(666, (proc_file) {fill_buffer_bcache_info, 0});
 }
 
 
@@ -11,6 +11,7 @@
 #define IDEINFO_INUM 999
 #define FILESTAT_INUM 888
 #define INODEINFO_INUM 777
+#define BCACHEINFO_INUM 666
 #define EMPTY_DIR_SZ 32
 
 typedef struct {
@@ -16,16 +16,18 @@
 int
 main(int argc, char *argv[])
 {
-  int fd, i;
+  int fd, i, n, start;
   char path[] = "stressfs0";
   char data[512];
 
   printf(1, "stressfs starting\n");
   memset(data, 'a', sizeof(data));
 
-  for(i = 0; i < 4; i++)
+  start = uptime();
+  for(n = 0; n < 4; n++)
     if(fork() > 0)
       break;
+  i = n;
 
   printf(1, "write %d\n", i);
 
@@ -45,5 +47,9 @@ main(int argc, char *argv[])
 
   wait();
 
+  if(n == 0)
+    printf(1, "stressfs: %d KB in %d ticks\n",
+           5 * 2 * 20 * sizeof(data) / 1024, uptime() - start);
+
   exit();
 }
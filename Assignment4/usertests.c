@@ -184,6 +184,10 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// into the double indirect blocks, across two of their leaves
+// where the disk has room for it; MAXFILE is more than the disk
+#define BIGBLOCKS (NDIRECT + NINDIRECT + (BSIZE <= 1024 ? 2*NINDIRECT : NINDIRECT/2))
+
 void
 writetest1(void)
 {
@@ -197,9 +201,9 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGBLOCKS; i++){
     ((int*)buf)[0] = i;
-    if(write(fd, buf, 512) != 512){
+    if(write(fd, buf, BSIZE) != BSIZE){
       printf(stdout, "error: write big file failed\n", i);
       exit();
     }
@@ -215,14 +219,14 @@ writetest1(void)
 
   n = 0;
   for(;;){
-    i = read(fd, buf, 512);
+    i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n == BIGBLOCKS - 1){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
       break;
-    } else if(i != 512){
+    } else if(i != BSIZE){
       printf(stdout, "read failed %d\n", i);
       exit();
     }
@@ -0,0 +1,109 @@
+// Page allocator throughput. Every child repeatedly grows its heap,
+// touches the new pages and gives them back, and now and then forks
+// a child that exits at once. Compare runs under make qemu CPUS=1..8.
+// Then one process grows a large heap touching a page every 4MB, forks
+// a child that exits at once, and gives the heap back.
+//
+// Under a paging policy a process has at most MAX_TOTAL_PAGES (32)
+// pages, so the churn stays well below that and the large heap is
+// BIGSWAPSZ with every page touched, pushing the process past
+// MAX_PSYC_PAGES (16) into the swap.
+// The 16MB heap needs SELECTION=NONE.
+//
+// usage: allocbench [nprocs]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NPAGES 8
+#define ROUNDS 200
+#define BIGSZ (16 * 1024 * 1024)
+#define BIGSWAPSZ (16 * 4096)
+#define BIGROUNDS 20
+
+void
+churn(void)
+{
+  char *mem;
+  int i, round;
+
+  for(round = 0; round < ROUNDS; round++){
+    if((mem = sbrk(NPAGES * 4096)) == (char*)-1){
+      printf(1, "allocbench: sbrk failed\n");
+      exit();
+    }
+    for(i = 0; i < NPAGES; i++)
+      mem[i * 4096] = i;
+    sbrk(-NPAGES * 4096);
+
+    if(round % 10 == 0){
+      if(fork() == 0)
+        exit();
+      wait();
+    }
+  }
+}
+
+void
+bigheap(int sz, int stride)
+{
+  char *mem;
+  int i, round;
+
+  for(round = 0; round < BIGROUNDS; round++){
+    if((mem = sbrk(sz)) == (char*)-1){
+      printf(1, "allocbench: no %d bytes of heap\n", sz);
+      return;
+    }
+    for(i = 0; i < sz; i += stride)
+      mem[i] = i;
+    if(fork() == 0)
+      exit();
+    wait();
+    sbrk(-sz);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 4, i, pid, start, sz, stride;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1)
+    n = 1;
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "allocbench: fork failed\n");
+      break;
+    }
+    if(pid == 0){
+      churn();
+      exit();
+    }
+  }
+  for(; i > 0; i--)
+    wait();
+
+  printf(1, "allocbench: %d procs, %d pages each, %d ticks\n",
+         n, ROUNDS * NPAGES, uptime() - start);
+
+  // only SELECTION=NONE has large pages, and no page limit
+  if(largepages(0) == 0){
+    sz = BIGSZ;
+    stride = 4 * 1024 * 1024;
+  } else {
+    sz = BIGSWAPSZ;
+    stride = 4096;
+  }
+  start = uptime();
+  bigheap(sz, stride);
+  printf(1, "allocbench: %d rounds of a %d KB heap, %d ticks\n",
+         BIGROUNDS, sz / 1024, uptime() - start);
+  exit();
+}
@@ -4,7 +4,12 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct pagestats;
 struct pipe;
+struct kmem_cache;
+struct slabinfo;
+struct ksminfo;
+struct shmseg;
 struct proc;
 struct rtcdate;
 struct spinlock;
@@ -36,6 +41,16 @@ int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
 
+// filemap.c
+void            pcacheinit(void);
+uint            pcache_get(struct inode*, uint, uint);
+uint            pcache_anon(void);
+int             pcache_exclusive(uint);
+void            pcache_dup(uint);
+void            pcache_put(uint);
+int             pcache_refs(uint);
+void            pcache_update(struct inode*, uint, uint);
+
 // fs.c
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
@@ -58,6 +73,7 @@ int		createSwapFile(struct proc* p);
 int		readFromSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size);
 int		writeToSwapFile(struct proc* p, char* buffer, uint placeOnFile, uint size);
 int		removeSwapFile(struct proc* p);
+int		truncateSwapFile(struct proc* p, uint size);
 void  copySwapFile(struct proc *src, struct proc *dst);
 
 // ide.c
@@ -73,6 +89,9 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+char*           kalloc_pages(int);
+void            kfree_pages(char*, int);
+void            kmemdump(void);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -88,12 +107,27 @@ void            lapicinit(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
+// ksm.c
+void            ksminit(void);
+void            ksm_scan(struct proc*);
+int             getksminfo(struct ksminfo*);
+void            ksmdump(void);
+
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
 
+// mmap.c
+int             mmap(uint, uint, int, int, struct file*, uint, struct shmseg*);
+int             munmap(uint, uint);
+void            munmap_all(struct proc*);
+int             dup_vmas(struct proc*, struct proc*);
+int             mmap_fault(struct proc*, uint, int);
+uint            mmap_floor(struct proc*);
+int             user_range_ok(struct proc*, uint, uint);
+
 // mp.c
 extern int      ismp;
 void            mpinit(void);
@@ -103,6 +137,7 @@ void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -134,6 +169,10 @@ int             unprotect_pg(const void *va);
 int             k_check_page_protected(const void *va);
 void            print_mem_stats(struct proc *p);
 void            print_total_pages_info();
+int             getpagestats(int, struct pagestats*);
+void            kthread_create(char*, void (*)(void));
+int             user_stopped(struct proc*);
+void            ksm_scan_procs(void);
 
 
 // swtch.S
@@ -170,6 +209,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argptr_ro(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -195,13 +235,17 @@ void            kvmalloc(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
+int             reserveuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
+void            release_swap_slots(struct proc*, pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
+void            tlb_flush_page(pde_t*, uint);
+void            tlb_flush_range(pde_t*, uint, uint);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
 
@@ -210,6 +254,14 @@ void            remove_page_flag(const void *va, uint flag_t);
 int             check_page_flag(const void *va, uint flag_t);
 pte_t *         non_stat_walkpgdir(pde_t *pgdir, const void *va, int alloc);
 int             page_in_the_missing(void *va);
+int             is_lazy_page(struct proc *p, const void *va);
+int             page_in_zero(void *va);
+int             page_in_lazy(void *va);
+int             is_shared_file_page(struct proc *p, const void *va);
+int             break_file_share(void *va);
+int             count_shared_pages(pde_t *pgdir, uint sz);
+int             count_large_pages(pde_t *pgdir, uint sz);
+int             fill_lazy_range(uint va, uint len, int write);
 
 void            zero_out_phys_address(const void *va);
 //void            register_page(struct proc *cur_proc, uint va, uint pa);
@@ -220,5 +272,32 @@ uint            va_to_pg_va_uint(uint va);
 
 void            init_pages_info();
 
+// shm.c
+void            shminit(void);
+int             shmget(int, uint);
+int             shmat(int);
+int             shmdt(uint);
+struct shmseg*  shm_anon(uint);
+uint            shm_page(struct shmseg*, int);
+void            shm_dup(struct shmseg*);
+void            shm_put(struct shmseg*);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint, void (*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void*           kmalloc(uint);
+void            kmfree(void*);
+int             getslabinfo(struct slabinfo*, int);
+
+// zswap.c
+void            zswapinit(void);
+int             zswap_store(char*);
+void            zswap_load(int, char*);
+void            zswap_dup(int);
+void            zswap_free(int);
+void            zswapdump(void);
+
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -17,8 +17,12 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
+  FileMap fmap[NFILEMAP], *fm;
   struct proc *curproc = myproc();
 
+  memset(fmap, 0, sizeof(fmap));
+  fm = fmap;
+
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -41,7 +45,9 @@ exec(char *path, char **argv)
   // new page dir - for upcoming program
   add_entry(pgdir);
 
-  // Load program into memory.
+  // Record the program segments, their pages are read from ip
+  // on first touch. Segments past the first NFILEMAP are loaded
+  // right away.
   sz = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
@@ -52,12 +58,24 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(fm == &fmap[NFILEMAP]){
+      // no FileMap left to page it in from: load it now
+      if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+        goto bad;
+      if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+        goto bad;
+      continue;
+    }
+    if((sz = reserveuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
       goto bad;
+    fm->ip = idup(ip);
+    fm->va = ph.vaddr;
+    fm->off = ph.off;
+    fm->filesz = ph.filesz;
+    fm->memsz = ph.memsz;
+    fm++;
   }
   iunlockput(ip);
   end_op();
@@ -97,13 +115,21 @@ exec(char *path, char **argv)
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
   // Commit to the user image.
+  munmap_all(curproc);
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
+  // the old image's paged out pages are gone with it
+  release_swap_slots(curproc, oldpgdir, 0, KERNBASE);
   freevm(oldpgdir);
+
+  begin_op();
+  clear_filemaps(curproc->fmap);
+  end_op();
+  memmove(curproc->fmap, fmap, sizeof(fmap));
   return 0;
 
  bad:
@@ -113,5 +139,8 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  begin_op();
+  clear_filemaps(fmap);
+  end_op();
   return -1;
 }
\ No newline at end of file
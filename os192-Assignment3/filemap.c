@@ -0,0 +1,277 @@
+// Demand paged executables.
+//
+// exec records every ELF segment as a FileMap instead of reading it.
+// The first touch of a page with file content maps a page of the
+// pcache: one physical copy of that part of the file, shared read-only
+// (PTE_SH) by every process running the same binary. A write to such a
+// page gives the process a private copy (see break_file_share in vm.c).
+//
+// Pages of mmap regions live in the pcache as well: file pages under
+// the same keys, anonymous pages without one (see mmap.c). There is
+// only ever one page for a part of a file: writei copies what it
+// writes into the cached page, so every mapper, and every later
+// reader, sees the file as it is now.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+struct pcpage {
+  uint dev;      // 0 for an anonymous page
+  uint inum;
+  uint off;      // file offset of the page content
+  uint n;        // bytes of file content up to its end, the rest is zero
+  uint pa;       // 0 if the slot is free
+  int ref;       // number of ptes mapping the page
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage pages[NPCACHE];
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Must hold pcache.lock.
+static struct pcpage*
+pcache_find(uint dev, uint inum, uint off)
+{
+  struct pcpage *pg;
+
+  for(pg = pcache.pages; pg < &pcache.pages[NPCACHE]; pg++)
+    if(pg->pa && pg->dev == dev && pg->inum == inum && pg->off == off)
+      return pg;
+  return 0;
+}
+
+// Must hold pcache.lock.
+static struct pcpage*
+pcache_find_pa(uint pa)
+{
+  struct pcpage *pg;
+
+  for(pg = pcache.pages; pg < &pcache.pages[NPCACHE]; pg++)
+    if(pg->pa == pa)
+      return pg;
+  return 0;
+}
+
+// Return the physical address of the shared page of ip at off: the
+// file content up to a page or the end of the file, and zeros after
+// it. Reads it on a miss. The caller gets a reference. n is how many
+// bytes of file content the caller expects; a caller that needs
+// zeros where the file has more, like the last page of an ELF
+// segment, gets 0 and must make its own copy. Also returns 0 when
+// out of memory or pcache slots.
+uint
+pcache_get(struct inode *ip, uint off, uint n)
+{
+  struct pcpage *pg;
+  char *mem;
+  uint m;
+
+  acquire(&pcache.lock);
+  if((pg = pcache_find(ip->dev, ip->inum, off)) != 0){
+    if(n < pg->n){
+      release(&pcache.lock);
+      return 0;
+    }
+    pg->ref++;
+    release(&pcache.lock);
+    return pg->pa;
+  }
+  release(&pcache.lock);
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+
+  ilock(ip);
+  m = off < ip->size ? ip->size - off : 0;
+  if(m > PGSIZE)
+    m = PGSIZE;
+  if(n < m || (m && readi(ip, mem, off, m) != m)){
+    iunlock(ip);
+    kfree(mem);
+    return 0;
+  }
+  iunlock(ip);
+
+  acquire(&pcache.lock);
+  // another process may have read the same page while we slept
+  if((pg = pcache_find(ip->dev, ip->inum, off)) != 0){
+    pg->ref++;
+    release(&pcache.lock);
+    kfree(mem);
+    return pg->pa;
+  }
+  if((pg = pcache_find_pa(0)) != 0){
+    pg->dev = ip->dev;
+    pg->inum = ip->inum;
+    pg->off = off;
+    pg->n = m;
+    pg->pa = V2P(mem);
+    pg->ref = 1;
+    release(&pcache.lock);
+    return pg->pa;
+  }
+  release(&pcache.lock);
+  kfree(mem);
+  return 0;
+}
+
+// Return the physical address of a zeroed page that no file lookup
+// finds, with one reference for the caller. Returns 0 when out of
+// memory or pcache slots.
+uint
+pcache_anon(void)
+{
+  struct pcpage *pg;
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+
+  acquire(&pcache.lock);
+  if((pg = pcache_find_pa(0)) != 0){
+    pg->pa = V2P(mem);
+    pg->ref = 1;
+    release(&pcache.lock);
+    return pg->pa;
+  }
+  release(&pcache.lock);
+  kfree(mem);
+  return 0;
+}
+
+// Whether the caller holds the only reference to pa and no file
+// lookup can find it, so it may write the page in place.
+int
+pcache_exclusive(uint pa)
+{
+  struct pcpage *pg;
+  int excl;
+
+  acquire(&pcache.lock);
+  if((pg = pcache_find_pa(pa)) == 0)
+    panic("pcache_exclusive");
+  excl = pg->ref == 1 && pg->dev == 0;
+  release(&pcache.lock);
+  return excl;
+}
+
+// Take another reference to a shared page, for fork.
+void
+pcache_dup(uint pa)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pcache_find_pa(pa)) == 0)
+    panic("pcache_dup");
+  pg->ref++;
+  release(&pcache.lock);
+}
+
+// Number of references to a shared page.
+int
+pcache_refs(uint pa)
+{
+  struct pcpage *pg;
+  int ref;
+
+  acquire(&pcache.lock);
+  if((pg = pcache_find_pa(pa)) == 0)
+    panic("pcache_refs");
+  ref = pg->ref;
+  release(&pcache.lock);
+  return ref;
+}
+
+// Drop a reference to a shared page, freeing it with the last one.
+void
+pcache_put(uint pa)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pcache_find_pa(pa)) == 0)
+    panic("pcache_put");
+  if(--pg->ref == 0){
+    memset(pg, 0, sizeof(*pg));
+    release(&pcache.lock);
+    kfree(P2V(pa));
+    return;
+  }
+  release(&pcache.lock);
+}
+
+// ip was written at [off, off+n): copy the new content into the
+// cached pages of that range. Caller must hold ip->lock, with
+// ip->size already covering the write.
+void
+pcache_update(struct inode *ip, uint off, uint n)
+{
+  struct pcpage *pg;
+  uint a, s, e, pa;
+
+  for(a = PGROUNDDOWN(off); a < off + n; a += PGSIZE){
+    acquire(&pcache.lock);
+    if((pg = pcache_find(ip->dev, ip->inum, a)) == 0){
+      release(&pcache.lock);
+      continue;
+    }
+    // our reference keeps the slot while readi sleeps
+    pg->ref++;
+    pa = pg->pa;
+    release(&pcache.lock);
+
+    s = off > a ? off - a : 0;
+    e = off + n - a < PGSIZE ? off + n - a : PGSIZE;
+    readi(ip, (char*)P2V(pa) + s, a + s, e - s);
+
+    acquire(&pcache.lock);
+    if(pg->n < e)
+      pg->n = e;
+    release(&pcache.lock);
+    pcache_put(pa);
+  }
+}
+
+// Return the file mapping of p covering va, or 0.
+FileMap*
+find_filemap(struct proc *p, uint va)
+{
+  FileMap *fm;
+
+  for(fm = p->fmap; fm < &p->fmap[NFILEMAP]; fm++)
+    if(fm->ip && va >= fm->va && va < fm->va + fm->memsz)
+      return fm;
+  return 0;
+}
+
+// Drop the inode references of a set of file mappings.
+// Must be called inside a transaction, as iput may free the inode.
+void
+clear_filemaps(FileMap *fmap)
+{
+  FileMap *fm;
+
+  for(fm = fmap; fm < &fmap[NFILEMAP]; fm++){
+    if(fm->ip)
+      iput(fm->ip);
+    memset(fm, 0, sizeof(*fm));
+  }
+}
@@ -400,19 +400,17 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
-// Truncate inode (discard contents).
-// Only called when the inode has no links
-// to it (no directory entries referring to it)
-// and has no in-memory reference to it (is
-// not an open file or current directory).
+// Shrink inode to size bytes, freeing the blocks past it.
+// Caller must hold ip->lock, inside a transaction.
 static void
-itrunc(struct inode *ip)
+itruncto(struct inode *ip, uint size)
 {
   int i, j;
   struct buf *bp;
   uint *a;
+  uint first = (size + BSIZE - 1) / BSIZE;  // first block to free
 
-  for(i = 0; i < NDIRECT; i++){
+  for(i = first; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
       ip->addrs[i] = 0;
@@ -422,19 +420,37 @@ itrunc(struct inode *ip)
   if(ip->addrs[NDIRECT]){
     bp = bread(ip->dev, ip->addrs[NDIRECT]);
     a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
+    for(j = first > NDIRECT ? first - NDIRECT : 0; j < NINDIRECT; j++){
+      if(a[j]){
         bfree(ip->dev, a[j]);
+        a[j] = 0;
+      }
+    }
+    if(first <= NDIRECT){
+      brelse(bp);
+      bfree(ip->dev, ip->addrs[NDIRECT]);
+      ip->addrs[NDIRECT] = 0;
+    } else {
+      log_write(bp);
+      brelse(bp);
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
-  ip->size = 0;
+  ip->size = size;
   iupdate(ip);
 }
 
+// Truncate inode (discard contents).
+// Only called when the inode has no links
+// to it (no directory entries referring to it)
+// and has no in-memory reference to it (is
+// not an open file or current directory).
+static void
+itrunc(struct inode *ip)
+{
+  itruncto(ip, 0);
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -508,6 +524,9 @@ writei(struct inode *ip, char *src, uint off, uint n)
     ip->size = off;
     iupdate(ip);
   }
+  // mapped pages of the file see the write
+  if(n > 0)
+    pcache_update(ip, off - n, n);
   return n;
 }
 
@@ -794,9 +813,13 @@ createSwapFile(struct proc* p)
 int
 writeToSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size)
 {
+  int n;
+
   p->swapFile->off = placeOnFile;
 
-  return filewrite(p->swapFile, buffer, size);
+  if((n = filewrite(p->swapFile, buffer, size)) > 0)
+    p->pmeta.rt_meta.swap_bytes_written += n;
+  return n;
 
 }
 
@@ -804,9 +827,33 @@ writeToSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size)
 int
 readFromSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size)
 {
+  int n;
+
   p->swapFile->off = placeOnFile;
 
-  return fileread(p->swapFile, buffer,  size);
+  if((n = fileread(p->swapFile, buffer,  size)) > 0)
+    p->pmeta.rt_meta.swap_bytes_read += n;
+  return n;
+}
+
+//shrink the swap file of p to size bytes, if it is larger
+int
+truncateSwapFile(struct proc *p, uint size)
+{
+  struct inode *ip;
+
+  if(0 == p->swapFile)
+    return -1;
+
+  ip = p->swapFile->ip;
+  begin_op();
+  ilock(ip);
+  if(size < ip->size)
+    itruncto(ip, size);
+  iunlock(ip);
+  end_op();
+
+  return 0;
 }
 
 char buffer[PGSIZE];
@@ -815,16 +862,16 @@ void
 copySwapFile(struct proc *src, struct proc *dst) {
   createSwapFile(dst);
 
-  int i = 0;
-  for(; i < PAGE_INFO_NUM; i++) {
-    PageInfo cur_pg_info = src->pmeta.paged_out_pages[i];
-    if (cur_pg_info.is_valid) {
-      if(readFromSwapFile(src, buffer, cur_pg_info.offset, PGSIZE) == -1) {
-        panic("reading swapFile during copy file");
-      }
-      if(writeToSwapFile(dst, buffer, cur_pg_info.offset, PGSIZE) == -1) {
-        panic("reading swapFile during copy file");
-      }
+  // slot by slot in file order, a write past the end of the file fails.
+  // Pages kept in zswap have no slot and are shared with dup_zswap_pages.
+  uint off = 0;
+  uint end = swap_slots_end(&src->pmeta);
+  for(; off < end; off += PGSIZE) {
+    if(readFromSwapFile(src, buffer, off, PGSIZE) == -1) {
+      panic("reading swapFile during copy file");
+    }
+    if(writeToSwapFile(dst, buffer, off, PGSIZE) == -1) {
+      panic("reading swapFile during copy file");
     }
   }
 }
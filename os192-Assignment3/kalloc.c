@@ -1,6 +1,7 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and physically
+// contiguous blocks of 2^order pages with kalloc_pages.
 
 #include "types.h"
 #include "defs.h"
@@ -10,18 +11,40 @@
 #include "spinlock.h"
 #include "proc.h"
 
+#if KMAXORDER < LPGORDER
+#error "kalloc_pages must hand out large pages"
+#endif
+
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
 struct run {
   struct run *next;
+  struct run *prev;
+};
+
+// Every CPU keeps a magazine of up to KMAGSIZE free pages, so most
+// calls to kalloc and kfree do not touch kmem.lock. Pages move between
+// a magazine and the buddy lists KMAGSIZE/2 at a time. Only the
+// owner takes the lock of a magazine, unless some CPU is out of free
+// pages and looks in the magazines of the others.
+struct kmag {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
 };
 
+// Free memory is kept in buddy lists: blocks of 2^order pages aligned
+// to their size. A freed block merges with its buddy, the other half
+// of the block twice its size, whenever that one is free too.
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *free[KMAXORDER + 1];  // free blocks of every order
+  int nfree[KMAXORDER + 1];
+  uchar order[PHYSTOP / PGSIZE];    // order + 1 of the free block a page starts, or 0
+  struct kmag mag[NCPU];
 } kmem;
 
 // Initialization happens in two phases.
@@ -32,7 +55,11 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.mag[i].lock, "kmag");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -53,6 +80,124 @@ freerange(void *vstart, void *vend)
     kfree(p);
 }
 //PAGEBREAK: 21
+// Must hold kmem.lock.
+static void
+buddy_push(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.free[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[order] = r;
+  kmem.nfree[order]++;
+  kmem.order[V2P(r) / PGSIZE] = order + 1;
+}
+
+// Must hold kmem.lock.
+static void
+buddy_unlink(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree[order]--;
+  kmem.order[V2P(r) / PGSIZE] = 0;
+}
+
+// Take a free block of the given order, splitting a larger one if
+// needed. Must hold kmem.lock.
+static struct run*
+buddy_alloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= KMAXORDER && kmem.free[k] == 0; k++)
+    ;
+  if(k > KMAXORDER)
+    return 0;
+
+  r = kmem.free[k];
+  buddy_unlink(r, k);
+  // the upper halves go back to the lists
+  while(k > order){
+    k--;
+    buddy_push((struct run*)((char*)r + (PGSIZE << k)), k);
+  }
+  return r;
+}
+
+// Must hold kmem.lock.
+static void
+buddy_free(char *v, int order)
+{
+  uint pa = V2P(v);
+  uint buddy;
+
+  for(; order < KMAXORDER; order++){
+    buddy = pa ^ (PGSIZE << order);
+    if(buddy >= PHYSTOP || kmem.order[buddy / PGSIZE] != order + 1)
+      break;
+    buddy_unlink((struct run*)P2V(buddy), order);
+    pa &= ~(PGSIZE << order);
+  }
+  buddy_push((struct run*)P2V(pa), order);
+}
+
+// Move up to n pages from the buddy lists to m.
+// Must hold m->lock.
+static void
+mag_refill(struct kmag *m, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(n-- > 0 && (r = buddy_alloc(0)) != 0){
+    r->next = m->freelist;
+    m->freelist = r;
+    m->n++;
+  }
+  release(&kmem.lock);
+}
+
+// Move n pages from m to the buddy lists.
+// Must hold m->lock.
+static void
+mag_drain(struct kmag *m, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(n-- > 0 && (r = m->freelist) != 0){
+    m->freelist = r->next;
+    m->n--;
+    buddy_free((char*)r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Take a page from any magazine, for when the magazine of this CPU
+// and the buddy lists are both empty. Returns 0 if there is none.
+static struct run*
+mag_steal(void)
+{
+  struct kmag *m;
+  struct run *r = 0;
+
+  for(m = kmem.mag; m < &kmem.mag[NCPU] && r == 0; m++){
+    acquire(&m->lock);
+    if((r = m->freelist) != 0){
+      m->freelist = r->next;
+      m->n--;
+    }
+    release(&m->lock);
+  }
+  return r;
+}
+
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
@@ -61,23 +206,33 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct kmag *m;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+#ifdef KDEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  __sync_fetch_and_add(&PAGES_AVAILABLE_CURRENTLY, 1);
 
-  PAGES_AVAILABLE_CURRENTLY++;
+  if(!kmem.use_lock){
+    buddy_free(v, 0);
+    return;
+  }
 
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  acquire(&m->lock);
+  r->next = m->freelist;
+  m->freelist = r;
+  if(++m->n > KMAGSIZE)
+    mag_drain(m, KMAGSIZE / 2);
+  release(&m->lock);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -87,31 +242,121 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kmag *m;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  if(!kmem.use_lock){
+    if((r = buddy_alloc(0)) != 0)
+      __sync_fetch_and_sub(&PAGES_AVAILABLE_CURRENTLY, 1);
+    return (char*)r;
+  }
+
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n == 0)
+    mag_refill(m, KMAGSIZE / 2);
+  if((r = m->freelist) != 0){
+    m->freelist = r->next;
+    m->n--;
+  }
+  release(&m->lock);
+  popcli();
+
+  if(r == 0)
+    r = mag_steal();
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+    __sync_fetch_and_sub(&PAGES_AVAILABLE_CURRENTLY, 1);
+
+  return (char*)r;
+}
+
+
+// Allocate 2^order physically contiguous pages, aligned to their size.
+// Returns 0 if there is no free block that large.
+char*
+kalloc_pages(int order)
+{
+  struct run *r;
+  struct kmag *m;
+
+  if(order < 0 || order > KMAXORDER)
+    panic("kalloc_pages");
+  if(order == 0)
+    return kalloc();
 
-  PAGES_AVAILABLE_CURRENTLY--;
+  acquire(&kmem.lock);
+  r = buddy_alloc(order);
+  release(&kmem.lock);
 
+  if(r == 0){
+    // the pages the CPUs cache may complete a block
+    for(m = kmem.mag; m < &kmem.mag[NCPU]; m++){
+      acquire(&m->lock);
+      mag_drain(m, m->n);
+      release(&m->lock);
+    }
+    acquire(&kmem.lock);
+    r = buddy_alloc(order);
+    release(&kmem.lock);
+  }
+
+  if(r)
+    __sync_fetch_and_sub(&PAGES_AVAILABLE_CURRENTLY, 1 << order);
   return (char*)r;
 }
 
+// Free a block returned by kalloc_pages(order).
+void
+kfree_pages(char *v, int order)
+{
+  if(order < 0 || order > KMAXORDER || V2P(v) % (PGSIZE << order))
+    panic("kfree_pages");
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+
+#ifdef KDEBUG
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  buddy_free(v, order);
+  __sync_fetch_and_add(&PAGES_AVAILABLE_CURRENTLY, 1 << order);
+  release(&kmem.lock);
+}
+
+// Print the free blocks of every order, and how much of the free
+// memory is not in blocks of the largest order.
+void
+kmemdump(void)
+{
+  int k, nfree = 0;
+
+  acquire(&kmem.lock);
+  cprintf("free blocks by order:");
+  for(k = 0; k <= KMAXORDER; k++){
+    cprintf(" %d", kmem.nfree[k]);
+    nfree += kmem.nfree[k] << k;
+  }
+  if(nfree > 0)
+    cprintf("\n%d%% of free pages are outside %dKB blocks \n",
+            100 - 100 * (kmem.nfree[KMAXORDER] << KMAXORDER) / nfree,
+            (PGSIZE << KMAXORDER) / 1024);
+  else
+    cprintf("\n");
+  release(&kmem.lock);
+}
 
 void
 init_pages_info() {
   int num_pages = 0;
-  struct run *r = kmem.freelist;
 
-  while (r) {
-    num_pages++;
-    r = r->next;
-  }
+  for (int k = 0; k <= KMAXORDER; k++)
+    num_pages += kmem.nfree[k] << k;
+  for (int i = 0; i < NCPU; i++)
+    num_pages += kmem.mag[i].n;
 
   PAGES_AVAILABLE_KERNEL_START = num_pages;
   PAGES_AVAILABLE_CURRENTLY = num_pages;
-}
\ No newline at end of file
+}
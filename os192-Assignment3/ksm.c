@@ -0,0 +1,258 @@
+// Kernel same-page merging.
+//
+// ksmd is a kernel thread that wakes up every KSMTICKS ticks and looks
+// at the private pages of the processes that asked for it with
+// mergeable(). A page the process did not write since the last pass
+// (PTE_D still clear) is hashed. If a page with the same content was
+// seen before, every process holding one maps a single read-only
+// pcache page (PTE_SH) instead and its own copy is freed. The first
+// write gives a process a private copy again, as for the pages of an
+// executable (see break_file_share in vm.c).
+//
+// ksmd changes the page table of a process only with ptable.lock held
+// and while the process is stopped where the kernel does not touch
+// its memory (see user_stopped in proc.c), so no CPU uses that page
+// table meanwhile.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "ksminfo.h"
+
+#define KSMTICKS 10            // ticks between passes
+#define NKSMCAND 64            // unmerged pages remembered for a match
+
+// A page of a process, hashed in an earlier pass.
+struct ksmcand {
+  struct proc *p;              // 0 if the slot is unused
+  int pid;
+  uint va;
+  uint pa;
+  uint sum;
+};
+
+struct {
+  struct spinlock lock;
+  struct {
+    uint pa;                   // merged pcache page, 0 if unused
+    uint sum;
+  } stable[NKSM];
+  struct ksmcand cand[NKSMCAND];
+  int nextcand;
+  int scans;
+  uint scanned;
+  uint merged;
+} ksm;
+
+static uint
+checksum(char *page)
+{
+  uint *w = (uint*)page, s = 0;
+  int i;
+
+  for(i = 0; i < PGSIZE / 4; i++)
+    s = s * 33 + w[i];
+  return s;
+}
+
+// The pte of a private page of p at va that may be merged, or 0.
+static pte_t*
+private_pte(struct proc *p, uint va)
+{
+  pde_t pde = p->pgdir[PDX(va)];
+  pte_t *pte;
+
+  if(!(pde & PTE_P) || (pde & PTE_PS))
+    return 0;
+  pte = (pte_t*)P2V(PTE_ADDR(pde)) + PTX(va);
+  if((*pte & (PTE_P|PTE_U|PTE_W)) != (PTE_P|PTE_U|PTE_W) ||
+     (*pte & (PTE_SH|PTE_PMALLOCED)))
+    return 0;
+  return pte;
+}
+
+// Map the merged page spa at va of p in place of its own page.
+static void
+remap(struct proc *p, pte_t *pte, uint va, uint spa)
+{
+  uint pa = PTE_ADDR(*pte);
+
+  pcache_dup(spa);
+  *pte = spa | PTE_P | PTE_U | PTE_SH;
+  unregister_page(p->pgdir, va, pa);
+  kfree(P2V(pa));
+  ksm.merged++;
+}
+
+// Whether the candidate still maps the same unwritten page as when
+// it was hashed, and its process is stopped.
+static pte_t*
+cand_pte(struct ksmcand *c)
+{
+  pte_t *pte;
+
+  if(c->p->pid != c->pid || !c->p->mergeable || !user_stopped(c->p))
+    return 0;
+  if(c->va >= c->p->sz || (pte = private_pte(c->p, c->va)) == 0)
+    return 0;
+  if(PTE_ADDR(*pte) != c->pa || (*pte & PTE_D))
+    return 0;
+  return pte;
+}
+
+// Merge the page of p at va with an identical one, or remember it.
+static void
+merge(struct proc *p, pte_t *pte, uint va)
+{
+  char *page = P2V(PTE_ADDR(*pte));
+  uint sum = checksum(page), spa;
+  struct ksmcand *c, *slot = 0;
+  pte_t *cpte;
+  int i;
+
+  for(i = 0; i < NKSM; i++){
+    if(ksm.stable[i].pa && ksm.stable[i].sum == sum &&
+       memcmp(P2V(ksm.stable[i].pa), page, PGSIZE) == 0){
+      remap(p, pte, va, ksm.stable[i].pa);
+      return;
+    }
+  }
+
+  for(c = ksm.cand; c < &ksm.cand[NKSMCAND]; c++){
+    if(c->p == 0)
+      continue;
+    if(c->p == p && c->va == va){
+      slot = c;
+      continue;
+    }
+    if(c->sum != sum || (cpte = cand_pte(c)) == 0 ||
+       memcmp(P2V(c->pa), page, PGSIZE) != 0)
+      continue;
+    for(i = 0; i < NKSM && ksm.stable[i].pa; i++)
+      ;
+    if(i == NKSM || (spa = pcache_anon()) == 0)
+      return;
+    memmove(P2V(spa), page, PGSIZE);
+    ksm.stable[i].pa = spa;
+    ksm.stable[i].sum = sum;
+    remap(c->p, cpte, c->va, spa);
+    remap(p, pte, va, spa);
+    c->p = 0;
+    return;
+  }
+
+  // a page hashed in an earlier pass keeps its slot
+  if(slot == 0)
+    slot = &ksm.cand[ksm.nextcand++ % NKSMCAND];
+  slot->p = p;
+  slot->pid = p->pid;
+  slot->va = va;
+  slot->pa = PTE_ADDR(*pte);
+  slot->sum = sum;
+}
+
+// Look at the pages of p below sz. Called by ksm_scan_procs, which
+// holds ptable.lock and checked that p is stopped.
+void
+ksm_scan(struct proc *p)
+{
+  pte_t *pte;
+  uint va;
+
+  acquire(&ksm.lock);
+  for(va = 0; va < p->sz; va += PGSIZE){
+    if(!(p->pgdir[PDX(va)] & PTE_P)){
+      va = PGADDR(PDX(va) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((pte = private_pte(p, va)) == 0)
+      continue;
+    // written since the last pass, look again in the next one
+    if(*pte & PTE_D){
+      *pte &= ~PTE_D;
+      continue;
+    }
+    ksm.scanned++;
+    merge(p, pte, va);
+  }
+  release(&ksm.lock);
+}
+
+// Start a pass: free the merged pages nobody maps any more.
+static void
+ksm_reclaim(void)
+{
+  int i;
+
+  acquire(&ksm.lock);
+  for(i = 0; i < NKSM; i++){
+    if(ksm.stable[i].pa && pcache_exclusive(ksm.stable[i].pa)){
+      pcache_put(ksm.stable[i].pa);
+      ksm.stable[i].pa = 0;
+    }
+  }
+  ksm.scans++;
+  release(&ksm.lock);
+}
+
+static void
+ksmd(void)
+{
+  uint ticks0;
+
+  for(;;){
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while(ticks - ticks0 < KSMTICKS)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    ksm_reclaim();
+    ksm_scan_procs();
+  }
+}
+
+void
+ksminit(void)
+{
+  initlock(&ksm.lock, "ksm");
+  kthread_create("ksmd", ksmd);
+}
+
+int
+getksminfo(struct ksminfo *ki)
+{
+  int i, n;
+
+  acquire(&ksm.lock);
+  ki->scans = ksm.scans;
+  ki->pages_scanned = ksm.scanned;
+  ki->pages_merged = ksm.merged;
+  ki->pages_shared = ki->pages_sharing = ki->pages_saved = 0;
+  for(i = 0; i < NKSM; i++){
+    if(ksm.stable[i].pa == 0)
+      continue;
+    // ksm holds a reference of its own
+    n = pcache_refs(ksm.stable[i].pa) - 1;
+    ki->pages_shared++;
+    ki->pages_sharing += n;
+    if(n > 1)
+      ki->pages_saved += n - 1;
+  }
+  release(&ksm.lock);
+  return 0;
+}
+
+void
+ksmdump(void)
+{
+  struct ksminfo ki;
+
+  getksminfo(&ki);
+  cprintf("%d merged pages mapped %d times, %d pages saved \n",
+          ki.pages_shared, ki.pages_sharing, ki.pages_saved);
+}
@@ -0,0 +1,88 @@
+// Kernel same-page merging. ksmdemo runs copies of itself that fill a
+// few heap pages the same way and sleep, and reports how many pages
+// ksmd saved by merging the identical pages of the copies.
+//
+// usage: ksmdemo [copies]
+
+#include "param.h"
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "ksminfo.h"
+
+#define NPAGES 4
+#define WAITTICKS 500
+
+void
+copy(void)
+{
+  char *p;
+  int i;
+
+  if((p = sbrk(NPAGES * 4096)) == (char*)-1){
+    printf(1, "ksmdemo: sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < NPAGES * 4096; i++)
+    p[i] = i % 251;
+  for(;;)
+    sleep(100);
+}
+
+void
+report(char *when, struct ksminfo *ki)
+{
+  printf(1, "%s: %d passes, %d pages merged, %d merged pages mapped %d times, %d pages saved\n",
+         when, ki->scans, ki->pages_merged, ki->pages_shared, ki->pages_sharing, ki->pages_saved);
+}
+
+int
+main(int argc, char *argv[])
+{
+  static char *copyargv[] = { "ksmdemo", "-c", 0 };
+  int pids[NPROC], n = NPROC - 8, i, start, saved;
+  struct ksminfo ki;
+
+  if(argc > 1 && strcmp(argv[1], "-c") == 0)
+    copy();
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 2 || n > NPROC)
+    n = NPROC - 8;
+
+  mergeable(1);
+  ksminfo(&ki);
+  report("before", &ki);
+
+  for(i = 0; i < n; i++){
+    if((pids[i] = fork()) < 0){
+      printf(1, "ksmdemo: fork failed\n");
+      break;
+    }
+    if(pids[i] == 0){
+      exec(copyargv[0], copyargv);
+      printf(1, "ksmdemo: exec failed\n");
+      exit();
+    }
+  }
+  n = i;
+  printf(1, "ksmdemo: %d copies running\n", n);
+
+  // wait until a few passes saved nothing more
+  start = uptime();
+  saved = -1;
+  while(uptime() - start < WAITTICKS){
+    sleep(50);
+    ksminfo(&ki);
+    if(ki.pages_saved == saved && saved > 0)
+      break;
+    saved = ki.pages_saved;
+  }
+  report("after", &ki);
+
+  for(i = 0; i < n; i++)
+    kill(pids[i]);
+  for(i = 0; i < n; i++)
+    wait();
+  exit();
+}
@@ -0,0 +1,9 @@
+// Counters of kernel same-page merging, filled by ksminfo().
+struct ksminfo {
+  int scans;                // Passes of ksmd over the mergeable processes
+  uint pages_scanned;       // Unwritten private pages hashed
+  uint pages_merged;        // Private pages replaced by a merged page
+  int pages_shared;         // Merged pages in use
+  int pages_sharing;        // Mappings of the merged pages
+  int pages_saved;          // Pages freed by merging, still not copied again
+};
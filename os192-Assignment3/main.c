@@ -30,12 +30,18 @@ main(void)
   tvinit();        // trap vectors
   binit();         // buffer cache
   fileinit();      // file table
+  pcacheinit();    // shared executable pages
+  zswapinit();     // compressed swap cache
+  slabinit();      // small object caches
+  pipeinit();      // pipe cache
+  shminit();       // shared memory segments
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
 
   init_pages_info();
 
+  ksminit();       // same-page merging thread, before the first user process
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -0,0 +1,10 @@
+// mmap protections and flags, shared by the kernel and user programs.
+
+#define PROT_READ     0x1   // Pages may be read
+#define PROT_WRITE    0x2   // Pages may be written
+
+#define MAP_SHARED    0x1   // Writes are seen by other mappers and go to the file
+#define MAP_PRIVATE   0x2   // Writes go to a private copy of the page
+#define MAP_ANONYMOUS 0x4   // Zero filled memory, no file
+
+#define MAP_FAILED    ((void*)-1)
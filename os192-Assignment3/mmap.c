@@ -0,0 +1,371 @@
+// Memory mapped files and anonymous memory.
+//
+// mmap only records a VmArea; pages are mapped on first touch. Every
+// page of a region is a pcache page (PTE_SH): a file page is the same
+// physical page every other mapper of that part of the file uses, so
+// reading a mapped file copies each block once, from the buffer cache
+// to the pcache, and never into a user buffer. A MAP_SHARED anonymous
+// region is an shm segment no key finds, whose pages every process
+// the region is forked into faults in (see shm.c). Private anonymous
+// pages are pcache pages no lookup finds.
+//
+// A MAP_SHARED page is mapped writable in every process, and fork
+// shares it with the child. A MAP_PRIVATE page is mapped read-only
+// while others may see it (the file, or a forked process); the first
+// write gives the process its own copy. Dirty pages of a shared file
+// mapping are written back when they are unmapped.
+//
+// Mapped pages are not registered with the paging policy and are
+// never swapped out.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+
+// Return the region of p holding va, or 0.
+VmArea*
+find_vma(struct proc *p, uint va)
+{
+  VmArea *v;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->start && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Lowest address mapped by mmap, the limit of the heap.
+uint
+mmap_floor(struct proc *p)
+{
+  VmArea *v;
+  uint floor = KERNBASE;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->start && v->start < floor)
+      floor = v->start;
+  return floor;
+}
+
+// Whether [va, va+n) is memory of p: below sz, or in one region.
+int
+user_range_ok(struct proc *p, uint va, uint n)
+{
+  VmArea *v;
+
+  if(va + n < va)
+    return 0;
+  if(va < p->sz && va + n <= p->sz)
+    return 1;
+  return (v = find_vma(p, va)) != 0 && va + n <= v->end;
+}
+
+static int
+overlaps(struct proc *p, uint start, uint end)
+{
+  VmArea *v;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->start && start < v->end && v->start < end)
+      return 1;
+  return 0;
+}
+
+// Map len bytes of f at off, or anonymous memory if f is 0.
+// addr is used if it is page aligned and free, otherwise the region
+// goes right below the lowest one. A MAP_SHARED anonymous region maps
+// shm, attached once for it, or a new segment if shm is 0.
+// Returns the address, or -1.
+int
+mmap(uint addr, uint len, int prot, int flags, struct file *f, uint off,
+     struct shmseg *shm)
+{
+  struct proc *curproc = myproc();
+  VmArea *v, *free = 0;
+  uint floor;
+
+  if(len == 0 || len > MMAPTOP || off % PGSIZE != 0)
+    return -1;
+  if(!(flags & MAP_SHARED) == !(flags & MAP_PRIVATE))
+    return -1;
+  len = PGROUNDUP(len);
+
+  if(f){
+    if(f->type != FD_INODE || f->ip->type != T_FILE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  for(v = curproc->vmas; v < &curproc->vmas[NVMA]; v++)
+    if(v->start == 0){
+      free = v;
+      break;
+    }
+  if(free == 0)
+    return -1;
+
+  if(addr == 0 || addr % PGSIZE != 0 || addr < PGROUNDUP(curproc->sz) ||
+     addr + len > MMAPTOP || addr + len < addr || overlaps(curproc, addr, addr + len)){
+    floor = mmap_floor(curproc);
+    if(floor > MMAPTOP)
+      floor = MMAPTOP;
+    if(floor < len || floor - len < PGROUNDUP(curproc->sz))
+      return -1;
+    addr = floor - len;
+  }
+
+  if(f == 0 && (flags & MAP_SHARED) && shm == 0){
+    if((shm = shm_anon(len)) == 0)
+      return -1;
+  }
+  if(f == 0)
+    off = 0;
+
+  free->start = addr;
+  free->end = addr + len;
+  free->prot = prot;
+  free->flags = flags;
+  free->f = f ? filedup(f) : 0;
+  free->off = off;
+  free->shm = shm;
+  return addr;
+}
+
+// Write the dirty page at a of a shared file region back to the
+// file, without growing it.
+static void
+writeback(VmArea *v, uint a, char *page)
+{
+  struct inode *ip = v->f->ip;
+  uint off = v->off + (a - v->start);
+  uint n, i, m, max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+
+  ilock(ip);
+  n = off < ip->size ? ip->size - off : 0;
+  iunlock(ip);
+  if(n > PGSIZE)
+    n = PGSIZE;
+
+  // a few blocks per transaction, as in filewrite
+  for(i = 0; i < n; i += m){
+    m = n - i < max ? n - i : max;
+    begin_op();
+    ilock(ip);
+    writei(ip, page + i, off + i, m);
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Unmap the pages of v in [start, end) from p.
+static void
+unmap_pages(struct proc *p, VmArea *v, uint start, uint end)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = start; a < end; a += PGSIZE){
+    if((pte = non_stat_walkpgdir(p->pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(!(*pte & PTE_P))
+      continue;
+    if(v->f && (v->flags & MAP_SHARED) && (*pte & PTE_D))
+      writeback(v, a, P2V(PTE_ADDR(*pte)));
+    pcache_put(PTE_ADDR(*pte));
+    *pte = 0;
+  }
+  tlb_flush_range(p->pgdir, start, end);
+}
+
+static void
+clear_vma(VmArea *v)
+{
+  if(v->f)
+    fileclose(v->f);
+  if(v->shm)
+    shm_put(v->shm);
+  memset(v, 0, sizeof(*v));
+}
+
+// Unmap [addr, addr+len) from the current process. Parts of regions
+// outside the range stay mapped. Returns 0, or -1 if addr is not
+// page aligned or a region would need a slot to split in two.
+int
+munmap(uint addr, uint len)
+{
+  struct proc *curproc = myproc();
+  uint end = PGROUNDUP(addr + len);
+  VmArea *v, *rest = 0;
+
+  if(addr % PGSIZE != 0 || len == 0 || end < addr)
+    return -1;
+
+  // unmapping the middle of a region leaves two of them
+  for(v = curproc->vmas; v < &curproc->vmas[NVMA]; v++)
+    if(v->start && v->start < addr && end < v->end)
+      break;
+  if(v < &curproc->vmas[NVMA]){
+    for(rest = curproc->vmas; rest < &curproc->vmas[NVMA]; rest++)
+      if(rest->start == 0)
+        break;
+    if(rest == &curproc->vmas[NVMA])
+      return -1;
+    *rest = *v;
+    rest->start = end;
+    rest->off += end - v->start;
+    if(rest->f)
+      filedup(rest->f);
+    if(rest->shm)
+      shm_dup(rest->shm);
+    unmap_pages(curproc, v, addr, end);
+    v->end = addr;
+    return 0;
+  }
+
+  for(v = curproc->vmas; v < &curproc->vmas[NVMA]; v++){
+    if(v->start == 0 || end <= v->start || v->end <= addr)
+      continue;
+    if(addr <= v->start && v->end <= end){
+      unmap_pages(curproc, v, v->start, v->end);
+      clear_vma(v);
+    } else if(addr <= v->start){
+      unmap_pages(curproc, v, v->start, end);
+      v->off += end - v->start;
+      v->start = end;
+    } else {
+      unmap_pages(curproc, v, addr, v->end);
+      v->end = addr;
+    }
+  }
+  return 0;
+}
+
+// Unmap every region of p, on exit and exec or when fork fails.
+void
+munmap_all(struct proc *p)
+{
+  VmArea *v;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++){
+    if(v->start == 0)
+      continue;
+    unmap_pages(p, v, v->start, v->end);
+    clear_vma(v);
+  }
+}
+
+// Give the child np the regions of p, sharing every page mapped so
+// far. Private pages turn read-only in both, to be copied on the
+// first write. Returns 0, or -1 when out of memory.
+int
+dup_vmas(struct proc *p, struct proc *np)
+{
+  VmArea *v;
+  pte_t *pte, *npte;
+  uint a;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++){
+    if(v->start == 0)
+      continue;
+    np->vmas[v - p->vmas] = *v;
+    if(v->f)
+      filedup(v->f);
+    if(v->shm)
+      shm_dup(v->shm);
+
+    for(a = v->start; a < v->end; a += PGSIZE){
+      if((pte = non_stat_walkpgdir(p->pgdir, (char*)a, 0)) == 0){
+        a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+        continue;
+      }
+      if(!(*pte & PTE_P))
+        continue;
+      if((npte = non_stat_walkpgdir(np->pgdir, (char*)a, 1)) == 0){
+        tlb_flush_range(p->pgdir, v->start, a);
+        return -1;
+      }
+      if(v->flags & MAP_PRIVATE)
+        *pte &= ~PTE_W;
+      // the parent writes back what it dirtied so far
+      *npte = *pte & ~PTE_D;
+      pcache_dup(PTE_ADDR(*pte));
+    }
+    if(v->flags & MAP_PRIVATE)
+      tlb_flush_range(p->pgdir, v->start, v->end);
+  }
+  return 0;
+}
+
+// Map the page of a region holding va, or give the process its own
+// copy of a private page it writes. Returns 1 on success, -1 if the
+// region does not allow the access or when out of memory. Also used
+// for pages the kernel touches for a system call, which must not
+// write to a read-only region either.
+int
+mmap_fault(struct proc *p, uint va, int write)
+{
+  VmArea *v;
+  uint a = PGROUNDDOWN(va);
+  uint off, n, pa, npa;
+  pte_t *pte;
+
+  if((v = find_vma(p, a)) == 0 || !(v->prot & (PROT_READ|PROT_WRITE)))
+    return -1;
+  if(write && !(v->prot & PROT_WRITE))
+    return -1;
+  if((pte = non_stat_walkpgdir(p->pgdir, (char*)a, 1)) == 0)
+    return -1;
+
+  if(!(*pte & PTE_P)){
+    n = 0;
+    off = v->off + (a - v->start);
+    if(v->f){
+      ilock(v->f->ip);
+      n = off < v->f->ip->size ? v->f->ip->size - off : 0;
+      iunlock(v->f->ip);
+    }
+    if(n > PGSIZE)
+      n = PGSIZE;
+    // private pages past the end of the file are anonymous; shared
+    // ones are zeroed pages of the file, so that all mappers get them
+    if(v->shm)
+      pa = shm_page(v->shm, off / PGSIZE);
+    else if(v->f && (n || (v->flags & MAP_SHARED)))
+      pa = pcache_get(v->f->ip, off, n);
+    else
+      pa = pcache_anon();
+    if(pa == 0)
+      return -1;
+    *pte = pa | PTE_P | PTE_U | PTE_SH;
+    if((v->prot & PROT_WRITE) && ((v->flags & MAP_SHARED) || pcache_exclusive(pa)))
+      *pte |= PTE_W;
+  }
+
+  if(!write || (*pte & PTE_W))
+    return 1;
+
+  // write to a private page others may see
+  pa = PTE_ADDR(*pte);
+  if(!pcache_exclusive(pa)){
+    if((npa = pcache_anon()) == 0)
+      return -1;
+    memmove(P2V(npa), P2V(pa), PGSIZE);
+    pcache_put(pa);
+    pa = npa;
+  }
+  *pte = pa | PTE_P | PTE_U | PTE_W | PTE_SH;
+  tlb_flush_page(p->pgdir, a);
+  return 1;
+}
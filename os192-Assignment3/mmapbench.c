@@ -0,0 +1,242 @@
+// read() against mmap for the loops of cat, grep and wc. Each round
+// opens the file and goes through it once; the mmap rounds map it and
+// unmap it again, so both sides start from the buffer cache.
+//
+// usage: mmapbench [file]
+// Without a file, mmapbench.dat is made as large as a file can be.
+// Every round's result is printed in parentheses to compare the two.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+#include "mman.h"
+
+#define ROUNDS 50
+#define BUFSZ 512
+#define BENCHFILE "mmapbench.dat"
+#define PATTERN "needle"
+
+char buf[BUFSZ];
+char line[BUFSZ];
+
+struct wcount {
+  int l, w, c, inword;
+};
+
+void
+wc_chunk(struct wcount *wc, char *p, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    wc->c++;
+    if(p[i] == '\n')
+      wc->l++;
+    if(strchr(" \r\t\n\v", p[i]))
+      wc->inword = 0;
+    else if(!wc->inword){
+      wc->w++;
+      wc->inword = 1;
+    }
+  }
+}
+
+int
+has_pattern(char *p, int n)
+{
+  int i, j, k = strlen(PATTERN);
+
+  for(i = 0; i + k <= n; i++){
+    for(j = 0; j < k && p[i + j] == PATTERN[j]; j++)
+      ;
+    if(j == k)
+      return 1;
+  }
+  return 0;
+}
+
+// the newline at or after p, or 0
+char*
+findnl(char *p, char *end)
+{
+  for(; p < end; p++)
+    if(*p == '\n')
+      return p;
+  return 0;
+}
+
+// cat: copy the file to a pipe drained by a child
+int
+cat_read(int fd, int out)
+{
+  int n, tot = 0;
+
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    tot += write(out, buf, n);
+  return tot;
+}
+
+int
+cat_mmap(char *p, int size, int out)
+{
+  return write(out, p, size);
+}
+
+// grep: count the lines holding PATTERN
+int
+grep_read(int fd)
+{
+  int n, m = 0, matches = 0;
+  char *p, *q;
+
+  while((n = read(fd, line + m, BUFSZ - m)) > 0){
+    m += n;
+    p = line;
+    while((q = findnl(p, line + m)) != 0){
+      matches += has_pattern(p, q - p);
+      p = q + 1;
+    }
+    if(p == line && m == BUFSZ)
+      m = 0;
+    if(m > 0){
+      m -= p - line;
+      memmove(line, p, m);
+    }
+  }
+  return matches + (m > 0 && has_pattern(line, m));
+}
+
+int
+grep_mmap(char *p, int size)
+{
+  char *end = p + size, *q;
+  int matches = 0;
+
+  while(p < end){
+    if((q = findnl(p, end)) == 0)
+      q = end;
+    matches += has_pattern(p, q - p);
+    p = q + 1;
+  }
+  return matches;
+}
+
+// wc
+int
+wc_read(int fd)
+{
+  struct wcount wc = { 0, 0, 0, 0 };
+  int n;
+
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    wc_chunk(&wc, buf, n);
+  return wc.w;
+}
+
+int
+wc_mmap(char *p, int size)
+{
+  struct wcount wc = { 0, 0, 0, 0 };
+
+  wc_chunk(&wc, p, size);
+  return wc.w;
+}
+
+void
+makefile(void)
+{
+  char *s;
+  int fd, i, n, len;
+
+  if((fd = open(BENCHFILE, O_CREATE | O_RDWR)) < 0){
+    printf(1, "mmapbench: cannot create %s\n", BENCHFILE);
+    exit();
+  }
+  // every tenth line matches PATTERN
+  for(i = 0, n = 0; ; i++, n += len){
+    s = i % 10 ? "the quick brown fox jumps over the lazy dog\n" : "a " PATTERN " in the haystack\n";
+    len = strlen(s);
+    if(n + len > MAXFILE * BSIZE || write(fd, s, len) != len)
+      break;
+  }
+  close(fd);
+}
+
+void
+run(char *path, int what, int usemap)
+{
+  static char *names[] = { "cat", "grep", "wc" };
+  struct stat st;
+  int fd, round, start, r = 0, pfd[2];
+  char *p;
+
+  if(what == 0){
+    if(pipe(pfd) < 0){
+      printf(1, "mmapbench: pipe failed\n");
+      exit();
+    }
+    if(fork() == 0){
+      close(pfd[1]);
+      while(read(pfd[0], buf, sizeof(buf)) > 0)
+        ;
+      exit();
+    }
+    close(pfd[0]);
+  }
+
+  start = uptime();
+  for(round = 0; round < ROUNDS; round++){
+    if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0){
+      printf(1, "mmapbench: cannot open %s\n", path);
+      exit();
+    }
+    if(!usemap){
+      if(what == 0)
+        r = cat_read(fd, pfd[1]);
+      else if(what == 1)
+        r = grep_read(fd);
+      else
+        r = wc_read(fd);
+    } else {
+      if((p = mmap(0, st.size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED){
+        printf(1, "mmapbench: mmap failed\n");
+        exit();
+      }
+      if(what == 0)
+        r = cat_mmap(p, st.size, pfd[1]);
+      else if(what == 1)
+        r = grep_mmap(p, st.size);
+      else
+        r = wc_mmap(p, st.size);
+      munmap(p, st.size);
+    }
+    close(fd);
+  }
+  printf(1, "%s %s: %d ticks for %d rounds of %d bytes (%d)\n", names[what],
+         usemap ? "mmap" : "read", uptime() - start, ROUNDS, st.size, r);
+
+  if(what == 0){
+    close(pfd[1]);
+    wait();
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *path = BENCHFILE;
+  int what;
+
+  if(argc > 1)
+    path = argv[1];
+  else
+    makefile();
+
+  for(what = 0; what < 3; what++){
+    run(path, what, 0);
+    run(path, what, 1);
+  }
+  exit();
+}
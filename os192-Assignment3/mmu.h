@@ -126,6 +126,8 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define LPGSIZE     0x400000    // bytes mapped by a large (PTE_PS) page
+#define LPGORDER        10      // log2(LPGSIZE / PGSIZE)
 
 #define PGSHIFT         12      // log2(PGSIZE)
 #define PTXSHIFT        12      // offset of PTX in a linear address
@@ -147,6 +149,7 @@ struct segdesc {
 
 #define PTE_PMALLOCED   0x400   // task 1
 #define PTE_PG          0x200   // task 2 - Paged out to secondary storage
+#define PTE_SH          0x800   // Page owned by the pcache: executable or mmap page
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
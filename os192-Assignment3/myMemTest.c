@@ -5,10 +5,34 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "pagestats.h"
+#include "fcntl.h"
+#include "mman.h"
 
 //#define MAX_PG 16
 //#define PG_SIZE 4096
 
+void print_page_stats() {
+  struct pagestats ps;
+
+  if (getpagestats(getpid(), &ps) < 0) {
+    printf(1, "getpagestats failed\n");
+    return;
+  }
+  // no 64-bit division in user space, report cycles in units of 1024
+  printf(1, "faults %d (major %d minor %d) in %d Kcycles\n", ps.page_faults,
+         ps.major_faults, ps.minor_faults, (uint)(ps.fault_cycles >> 10));
+  printf(1, "paged out %d prefetched %d second chances %d\n", ps.paged_out_ever,
+         ps.pages_prefetched, ps.second_chances);
+  printf(1, "swap read %d written %d bytes\n", ps.swap_bytes_read, ps.swap_bytes_written);
+  printf(1, "zswap stored %d loaded %d pages\n", ps.zswap_stores, ps.zswap_loads);
+  printf(1, "tlb invlpg %d flushes %d cr3 skips %d\n", ps.tlb_invlpgs, ps.tlb_flushes,
+         ps.cr3_skips);
+  printf(1, "resident %d (shared %d) swapped %d pages, %d large pages\n",
+         ps.phys_pages + ps.shared_pages, ps.shared_pages, ps.paged_out_pages,
+         ps.large_pages);
+}
+
 void paging_with_no_swap() {
   int pid;
   void *arr[16];
@@ -138,6 +162,306 @@ void swapping_speed() {
   }
 }
 
+void sequential_scan_speed() {
+  int pid;
+  int npages = 12;  // the parent already holds about 15 of MAX_TOTAL_PAGES
+  char *mem;
+  int i, round, start;
+  printf(1, "\n***Sequential scan over swapped pages test***\n\n");
+  if ((pid = fork()) == 0) {
+    mem = sbrk(npages * 4096);
+    for (i = 0; i < npages; i++)
+      mem[i * 4096] = (char)i;
+
+    start = uptime();
+    for (round = 0; round < 10; round++) {
+      for (i = 0; i < npages; i++) {
+        if (mem[i * 4096] != (char)i) {
+          printf(1, "\n***Sequential scan FAILED page[%d]***\n", i);
+          exit();
+        }
+      }
+    }
+    printf(1, "%d sequential scans of %d pages took %d ticks\n", round, npages, uptime() - start);
+    print_page_stats();
+    exit();
+  } else {
+    wait();
+    printf(1, "\n***Sequential scan over swapped pages ended***\n");
+  }
+}
+
+void sbrk_startup_speed() {
+  int pid;
+  int npages = 12;
+  char *mem;
+  int i, start, reserved;
+  printf(1, "\n***Sbrk startup test***\n\n");
+  if ((pid = fork()) == 0) {
+    start = uptime();
+    mem = sbrk(npages * 4096);
+    reserved = uptime() - start;
+    for (i = 0; i < npages; i += 2)
+      mem[i * 4096] = (char)i;
+    printf(1, "sbrk of %d pages took %d ticks, touching half of them %d ticks\n",
+           npages, reserved, uptime() - start - reserved);
+    for (i = 1; i < npages; i += 2) {
+      if (mem[i * 4096] != 0) {
+        printf(1, "\n***Sbrk startup FAILED untouched page[%d] not zero***\n", i);
+        exit();
+      }
+    }
+    print_page_stats();
+    exit();
+  } else {
+    wait();
+    printf(1, "\n***Sbrk startup ended***\n");
+  }
+}
+
+void swap_churn() {
+  int pid;
+  int npages = 12;
+  char *mem;
+  int i, round;
+  printf(1, "\n***Swap churn test***\n\n");
+  if ((pid = fork()) == 0) {
+    for (round = 0; round < 50; round++) {
+      if ((mem = sbrk(npages * 4096)) == (char*)-1) {
+        printf(1, "\n***Swap churn FAILED sbrk in round %d***\n", round);
+        exit();
+      }
+      for (i = 0; i < npages; i++)
+        mem[i * 4096] = (char)(round + i);
+      for (i = 0; i < npages; i++) {
+        if (mem[i * 4096] != (char)(round + i)) {
+          printf(1, "\n***Swap churn FAILED round %d page[%d]***\n", round, i);
+          exit();
+        }
+      }
+      sbrk(-npages * 4096);
+    }
+    printf(1, "grew and shrank %d pages %d times\n", npages, round);
+    print_page_stats();
+    exit();
+  } else {
+    wait();
+    printf(1, "\n***Swap churn ended***\n");
+  }
+}
+
+// Even pages are mostly zero, odd pages are noise that does not
+// compress, so both zswap and the swap file get used.
+uint compressed_swap_word(int page, int i) {
+  if (page % 2 == 0)
+    return i % 256 == 0 ? page * 1000 + i : 0;
+  return (page * 2654435761u) ^ (i * 40503u) ^ (i << 17);
+}
+
+int compressed_swap_check(uint *mem, int npages) {
+  int page, i;
+
+  for (page = 0; page < npages; page++)
+    for (i = 0; i < 1024; i++)
+      if (mem[page * 1024 + i] != compressed_swap_word(page, i))
+        return page;
+  return -1;
+}
+
+void compressed_swap() {
+  int pid;
+  int npages = 12;
+  uint *mem;
+  int page, i, round, start;
+  printf(1, "\n***Compressed swap test***\n\n");
+  if ((pid = fork()) == 0) {
+    mem = (uint*)sbrk(npages * 4096);
+    for (page = 0; page < npages; page++)
+      for (i = 0; i < 1024; i++)
+        mem[page * 1024 + i] = compressed_swap_word(page, i);
+
+    start = uptime();
+    for (round = 0; round < 5; round++) {
+      if ((page = compressed_swap_check(mem, npages)) >= 0) {
+        printf(1, "\n***Compressed swap FAILED page[%d]***\n", page);
+        exit();
+      }
+    }
+    printf(1, "%d checks of %d pages took %d ticks\n", round, npages, uptime() - start);
+    print_page_stats();
+
+    // the child shares the compressed pages
+    if (fork() == 0) {
+      if ((page = compressed_swap_check(mem, npages)) >= 0)
+        printf(1, "\n***Compressed swap FAILED in child page[%d]***\n", page);
+      exit();
+    }
+    wait();
+    exit();
+  } else {
+    wait();
+    printf(1, "\n***Compressed swap ended***\n");
+  }
+}
+
+// MAP_SHARED pages are seen by a forked child, MAP_PRIVATE pages are
+// copied on write, writes to a shared file mapping reach the file,
+// and all mappers of a part of a file share one page.
+void mmap_test() {
+  char *shared, *private, *file;
+  char data[8];
+  int fd, pfd[2], ok = 1;
+  printf(1, "\n***Mmap test***\n\n");
+
+  shared = mmap(0, 2 * 4096, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  private = mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED || private == MAP_FAILED) {
+    printf(1, "\n***Mmap FAILED to map anonymous memory***\n");
+    return;
+  }
+  shared[4096] = 1;
+  private[0] = 1;
+  if (fork() == 0) {
+    shared[4096] = 2;
+    private[0] = 2;
+    exit();
+  }
+  wait();
+  if (shared[4096] != 2 || private[0] != 1) {
+    printf(1, "\n***Mmap FAILED: shared %d private %d***\n", shared[4096], private[0]);
+    ok = 0;
+  }
+  munmap(shared, 2 * 4096);
+  munmap(private, 4096);
+
+  fd = open("mmaptest", O_CREATE | O_RDWR);
+  write(fd, "abcdefgh", 8);
+  file = mmap(0, 8, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  file[0] = 'x';
+  munmap(file, 8);
+  file = mmap(0, 8, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (file[0] != 'a') {
+    printf(1, "\n***Mmap FAILED: private write reached the file***\n");
+    ok = 0;
+  }
+  file[1] = 'y';
+  munmap(file, 8);
+  close(fd);
+
+  fd = open("mmaptest", O_RDONLY);
+  read(fd, data, 8);
+  close(fd);
+  unlink("mmaptest");
+  if (data[0] != 'a' || data[1] != 'y') {
+    printf(1, "\n***Mmap FAILED: file holds %c%c***\n", data[0], data[1]);
+    ok = 0;
+  }
+
+  // A and B share a page of the file; A writes and unmaps, which
+  // writes the page back. B writes again and keeps the page: C must
+  // map the same page and see B's write.
+  fd = open("mmaptest", O_CREATE | O_RDWR);
+  write(fd, "abcdefgh", 8);
+  file = mmap(0, 8, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (fork() == 0) {
+    char *a = mmap(0, 8, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    a[0] = 'A';
+    munmap(a, 8);
+    exit();
+  }
+  wait();
+  file[1] = 'B';
+  pipe(pfd);
+  if (fork() == 0) {
+    char *c = mmap(0, 8, PROT_READ, MAP_SHARED, fd, 0);
+    data[0] = c[0];
+    data[1] = c[1];
+    write(pfd[1], data, 2);
+    exit();
+  }
+  wait();
+  read(pfd[0], data, 2);
+  close(pfd[0]);
+  close(pfd[1]);
+  if (data[0] != 'A' || data[1] != 'B') {
+    printf(1, "\n***Mmap FAILED: a new mapper sees %c%c***\n", data[0], data[1]);
+    ok = 0;
+  }
+  munmap(file, 8);
+  close(fd);
+  unlink("mmaptest");
+
+  if (ok)
+    printf(1, "shared, private and file mappings ok\n");
+  printf(1, "\n***Mmap test ended***\n");
+}
+
+// Random reads over a 16MB heap, mapped with 4KB pages and then
+// with large pages. Large pages need SELECTION=NONE.
+void large_page_walk() {
+  uint npages = 4096;
+  uint *a, i, idx, sum;
+  int mode, start;
+  printf(1, "\n***Large page random walk test***\n\n");
+  if (largepages(0) < 0) {
+    printf(1, "large pages need SELECTION=NONE\n");
+    return;
+  }
+  for (mode = 0; mode < 2; mode++) {
+    if (fork() == 0) {
+      largepages(mode);
+      a = (uint*)sbrk(npages * 4096);
+      for (i = 0; i < npages * 1024; i += 1024)
+        a[i] = i;
+
+      start = uptime();
+      for (i = 0, idx = 1, sum = 0; i < 4000000; i++) {
+        idx = idx * 1103515245 + 12345;
+        sum += a[(idx >> 8) % (npages * 1024)];
+      }
+      printf(1, "%s pages: %d ticks (sum %d)\n", mode ? "large" : "4KB",
+             uptime() - start, sum);
+      print_page_stats();
+      exit();
+    }
+    wait();
+  }
+  printf(1, "\n***Large page random walk ended***\n");
+}
+
+void exec_startup_speed() {
+  char *echo_args[] = { "echo", "exec", 0 };
+  char *stats_args[] = { "myMemTest", "stats", "0", 0 };
+  char idx[] = "0";
+  int i, start;
+  printf(1, "\n***Exec startup test***\n\n");
+
+  start = uptime();
+  for (i = 0; i < 10; i++) {
+    if (fork() == 0) {
+      exec(echo_args[0], echo_args);
+      printf(1, "exec %s failed\n", echo_args[0]);
+      exit();
+    }
+    wait();
+  }
+  printf(1, "%d runs of %s took %d ticks\n", i, echo_args[0], uptime() - start);
+
+  // concurrent instances share the text pages of the binary
+  for (i = 0; i < 3; i++) {
+    idx[0] = '0' + i;
+    stats_args[2] = idx;
+    if (fork() == 0) {
+      exec(stats_args[0], stats_args);
+      printf(1, "exec %s failed\n", stats_args[0]);
+      exit();
+    }
+  }
+  for (i = 0; i < 3; i++)
+    wait();
+  printf(1, "\n***Exec startup ended***\n");
+}
+
 void fork_with_swap_file() {
   printf(1, "\n***Fork with swap test***\n\n");
 
@@ -190,6 +514,15 @@ void protect_page_test() {
 }
 
 int main(int argc, char *argv[]) {
+  // run by exec_startup_speed - report, while the other instances live
+  if (argc > 2 && strcmp(argv[1], "stats") == 0) {
+    sleep(20 * atoi(argv[2]));
+    printf(1, "instance %s: ", argv[2]);
+    print_page_stats();
+    sleep(60);
+    exit();
+  }
+
   printf(1, "\n***MEMORY TESTS - R U READY ?!***\n");
 
   protect_page_test();
@@ -197,6 +530,13 @@ int main(int argc, char *argv[]) {
   maximum_paging();
   paging_with_swap_access();
   swapping_speed();
+  sequential_scan_speed();
+  sbrk_startup_speed();
+  swap_churn();
+  compressed_swap();
+  large_page_walk();
+  mmap_test();
+  exec_startup_speed();
   fork_with_swap_file();
 
   printf(1, "\n***ALL TESTS ENDED***\n");
@@ -0,0 +1,23 @@
+// Paging statistics of a process, filled by getpagestats().
+struct pagestats {
+  int policy;               // Page replacement policy (1 LIFO, 2 SCFIFO, 3 NONE)
+  int phys_pages;           // Pages currently in physical memory
+  int shared_pages;         // Executable pages shared with other processes
+  int large_pages;          // 4MB pages, not counted in phys_pages
+  int paged_out_pages;      // Pages currently swapped out
+  int protected_pages;      // Pages protected with protect_page()
+  int page_faults;          // Page faults handled for the process
+  int major_faults;         // Faults that read from the swap file
+  int minor_faults;         // Faults resolved without reading the swap file
+  uint64 fault_cycles;      // rdtsc cycles spent handling faults
+  int paged_out_ever;       // Pages evicted to the swap file
+  int pages_prefetched;     // Pages brought in ahead of a fault
+  int second_chances;       // Pages spared by SCFIFO for being accessed
+  uint swap_bytes_read;     // Bytes read from the swap file
+  uint swap_bytes_written;  // Bytes written to the swap file
+  int zswap_stores;         // Evicted pages kept compressed in memory
+  int zswap_loads;          // Faults served from the compressed cache
+  int tlb_invlpgs;          // Single TLB entries flushed with invlpg
+  int tlb_flushes;          // Whole TLB flushes, by loading cr3
+  int cr3_skips;            // Switches to the process that kept its TLB
+};
@@ -60,7 +60,7 @@ int clean_page_info(PageMeta *pm, uint virt_address) {
   return 1;
 }
 
-int save_page_info(PageMeta *pm, uint offset, uint virt_address) {
+int save_page_info(PageMeta *pm, uint offset, uint virt_address, int zhandle) {
   uint page_va = va_to_pg_va_uint(virt_address);
 
   PageInfo *pinfo;
@@ -71,6 +71,7 @@ int save_page_info(PageMeta *pm, uint offset, uint virt_address) {
   pinfo->is_valid = 1;
   pinfo->offset = offset;
   pinfo->virt_address = page_va;
+  pinfo->zhandle = zhandle;
 
   return 1;
 }
@@ -88,6 +89,73 @@ int reset_all_pages_meta(PageMeta *pm) {
   return 1;
 }
 
+// Take the lowest free swap slot. Returns its offset in the swap file,
+// or -1 if all PAGE_INFO_NUM slots are in use.
+int alloc_swap_slot(PageMeta *pm) {
+  for (int i = 0; i < PAGE_INFO_NUM; ++i) {
+    if (!(pm->swap_slots & (1 << i))) {
+      pm->swap_slots |= 1 << i;
+      return i * PGSIZE;
+    }
+  }
+
+  return -1;
+}
+
+void free_swap_slot(PageMeta *pm, uint offset) {
+  pm->swap_slots &= ~(1 << (offset / PGSIZE));
+}
+
+// Size the swap file needs to keep every slot in use.
+uint swap_slots_end(PageMeta *pm) {
+  int i = PAGE_INFO_NUM;
+
+  while (i > 0 && !(pm->swap_slots & (1 << (i - 1))))
+    i--;
+
+  return i * PGSIZE;
+}
+
+// A forked child took a copy of the page meta - it refers to the
+// same zswap entries.
+void dup_zswap_pages(PageMeta *pm) {
+  for (int i = 0; i < PAGE_INFO_NUM; ++i) {
+    if (pm->paged_out_pages[i].is_valid && pm->paged_out_pages[i].zhandle)
+      zswap_dup(pm->paged_out_pages[i].zhandle);
+  }
+}
+
+void free_zswap_pages(PageMeta *pm) {
+  for (int i = 0; i < PAGE_INFO_NUM; ++i) {
+    if (pm->paged_out_pages[i].is_valid && pm->paged_out_pages[i].zhandle) {
+      zswap_free(pm->paged_out_pages[i].zhandle);
+      pm->paged_out_pages[i].zhandle = 0;
+    }
+  }
+}
+
+// Keep the page at virt_address in memory until the system call
+// returns. Returns 0, or -1 if one more page cannot be kept: at
+// least one page must be left to evict.
+int pin_page(PageMeta *pm, uint virt_address) {
+  uint page_va = va_to_pg_va_uint(virt_address);
+
+  if (is_page_pinned(pm, page_va))
+    return 0;
+  if (pm->npinned == MAX_PSYC_PAGES - 1)
+    return -1;
+  pm->pinned[pm->npinned++] = page_va;
+  return 0;
+}
+
+int is_page_pinned(PageMeta *pm, uint virt_address) {
+  for (int i = 0; i < pm->npinned; ++i) {
+    if (pm->pinned[i] == virt_address)
+      return 1;
+  }
+  return 0;
+}
+
 int count_paged_out(PageMeta *pm) {
   int n = 0;
   for (int i = 0; i < PAGE_INFO_NUM; ++i) {
@@ -146,21 +214,33 @@ PVA* removePageFromQueue(PVA *pva, pde_t * pgdir){
   return pva;
 }
 
+// The loser selectors skip pinned pages, and return 0 when every
+// page in memory is pinned.
 PVA* select_loser_page_by_lifo(){
   pde_t *pgdir = myproc()->pgdir;
+  PageMeta *pm = &myproc()->pmeta;
   PVA *last = find_entry(pgdir)->last;
-  PVA *loser_address = removePageFromQueue(last, pgdir);
-  return loser_address;
+
+  while (last != 0 && is_page_pinned(pm, last->va))
+    last = last->prev;
+  if (last == 0)
+    return 0;
+  return removePageFromQueue(last, pgdir);
 }
 
 PVA* select_loser_page_by_scfifo(){
   pde_t *pgdir = myproc()->pgdir;
+  PageMeta *pm = &myproc()->pmeta;
   PgdirPhysPagesEntry *entry = find_entry(pgdir);
   PVA *cur_node = entry->first;
 
   while(cur_node != 0) {
-    if (check_page_flag(&cur_node->va, PTE_A)) {
-      remove_page_flag(&cur_node->va, PTE_A);
+    if (is_page_pinned(pm, cur_node->va)) {
+      cur_node = cur_node->next;
+    }
+    else if (check_page_flag((void*)cur_node->va, PTE_A)) {
+      remove_page_flag((void*)cur_node->va, PTE_A);
+      pm->rt_meta.num_second_chances++;
       cur_node = cur_node->next;
     }
     else {
@@ -168,7 +248,12 @@ PVA* select_loser_page_by_scfifo(){
     }
   }
 
-  return removePageFromQueue(entry->first, pgdir);
+  // everybody had a second chance
+  for (cur_node = entry->first; cur_node != 0; cur_node = cur_node->next) {
+    if (!is_page_pinned(pm, cur_node->va))
+      return removePageFromQueue(cur_node, pgdir);
+  }
+  return 0;
 }
 
 PVA *find_equal_node_in_array(pde_t *pgdir, PVA *the_who) {
@@ -194,6 +279,7 @@ void arrange_pva_linklist_of_newborn_proc(pde_t *pgdir, PVA *fathers_first) {
 
   if (!(entry->first = find_equal_node_in_array(pgdir, fathers_first)))
     panic("where first?");
+  entry->first->prev = 0;
 
   // after we find the first node - it still points to father's nodes
   fathers_node = entry->first->next;
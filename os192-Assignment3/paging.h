@@ -36,6 +36,11 @@
 #define MAX_PSYC_PAGES 16
 #define MAX_TOTAL_PAGES 32
 #define PAGE_INFO_NUM (MAX_TOTAL_PAGES - MAX_PSYC_PAGES)
+#define PREFETCH_MAX 4  // most pages brought in by one fault-around
+
+#if PAGE_INFO_NUM > 32
+  #error "swap_slots bitmap holds at most 32 slots"
+#endif
 
 int PAGES_AVAILABLE_KERNEL_START;
 int PAGES_AVAILABLE_CURRENTLY;
@@ -43,28 +48,55 @@ int PAGES_AVAILABLE_CURRENTLY;
 typedef struct {
   int num_protected_pages;
   int num_page_faults;
+  int num_major_faults;
+  int num_minor_faults;
+  uint64 fault_cycles;
   int num_paged_out_ever;
+  int num_pages_prefetched;
+  int num_second_chances;
+  uint swap_bytes_read;
+  uint swap_bytes_written;
+  int num_zswap_stores;
+  int num_zswap_loads;
+  int num_tlb_invlpgs;
+  int num_tlb_flushes;
+  int num_cr3_skips;
 } RuntimeMeta;
 
 typedef struct {
   int is_valid;
   uint offset;
   uint virt_address;
+  int zhandle;      // zswap entry holding the page, 0 if it is in the swap file
 } PageInfo;
 
 typedef struct {
   PageInfo paged_out_pages[PAGE_INFO_NUM];
   int file_exists;
-  uint cur_swap_offset;
+  uint swap_slots;          // bit i set - swap file slot at i * PGSIZE is in use
+  uint next_seq_fault_va;   // where a sequential scan is expected to fault next
+  int prefetch_window;      // pages to bring in on that fault
+  uint pinned[MAX_PSYC_PAGES - 1]; // pages the current system call uses, never evicted
+  int npinned;
   RuntimeMeta rt_meta;
 } PageMeta;
 
+PageInfo *find_page(PageMeta *pm, uint virt_address);
 int does_page_exist(PageMeta *pm, uint virt_address);
 int offset_of_page(PageMeta *pm, uint virt_address);
 int clean_page_info(PageMeta *pm, uint virt_address);
-int save_page_info(PageMeta *pm, uint offset, uint virt_address);
+int save_page_info(PageMeta *pm, uint offset, uint virt_address, int zhandle);
 int reset_all_pages_meta(PageMeta *pm);
 
+int alloc_swap_slot(PageMeta *pm);
+void free_swap_slot(PageMeta *pm, uint offset);
+uint swap_slots_end(PageMeta *pm);
+void dup_zswap_pages(PageMeta *pm);
+void free_zswap_pages(PageMeta *pm);
+
+int pin_page(PageMeta *pm, uint virt_address);
+int is_page_pinned(PageMeta *pm, uint virt_address);
+
 int count_paged_out(PageMeta *pm);
 int is_something_paged_out(PageMeta *pm);
 
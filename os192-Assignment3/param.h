@@ -5,6 +5,8 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
+#define KMAGSIZE     64  // free pages kalloc keeps on each CPU
+#define KMAXORDER    10  // largest kalloc_pages block, 2^10 pages (4MB)
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
@@ -14,7 +16,16 @@
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define FSSIZE       2000  // size of file system in blocks
+#define NFILEMAP      2  // demand paged executable segments per process
+#define NPCACHE     512  // executable and mmap pages shared between processes
+#define NVMA          8  // mmap regions per process
+#define NSHM         16  // shared memory segments
+#define SHMMAXPAGES 256  // pages in a shm segment or shared anonymous mapping
+#define NZSWAP      256  // pages kept in the compressed swap cache
+#define NZPOOL       64  // pool pages holding compressed pages
+#define NSLABCACHE   16  // kernel object caches
+#define NKSM        128  // pages merged by ksmd
 
 
 #endif
\ No newline at end of file
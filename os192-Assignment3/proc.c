@@ -4,8 +4,10 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
+#include "traps.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "pagestats.h"
 
 struct {
   struct spinlock lock;
@@ -71,9 +73,10 @@ myproc(void) {
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
 // state required to run in the kernel.
-// Otherwise return 0.
+// Otherwise return 0. A kernel thread gets pid 0: it is
+// no user process, and init stays pid 1.
 static struct proc*
-allocproc(void)
+allocproc(int kthread)
 {
   struct proc *p;
   char *sp;
@@ -89,7 +92,7 @@ allocproc(void)
 
 found:
   p->state = EMBRYO;
-  p->pid = nextpid++;
+  p->pid = kthread ? 0 : nextpid++;
 
   release(&ptable.lock);
 
@@ -116,6 +119,10 @@ found:
 
   // task 2
   reset_all_pages_meta(&p->pmeta);
+  memset(p->fmap, 0, sizeof(p->fmap));
+  memset(p->vmas, 0, sizeof(p->vmas));
+  p->largepages = 0;
+  p->mergeable = 0;
 
   return p;
 }
@@ -128,7 +135,7 @@ userinit(void)
   struct proc *p;
   extern char _binary_initcode_start[], _binary_initcode_size[];
 
-  p = allocproc();
+  p = allocproc(0);
   
   initproc = p;
   if((p->pgdir = setupkvm()) == 0)
@@ -171,14 +178,17 @@ growproc(int n)
   struct proc *curproc = myproc();
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if(sz + n > mmap_floor(curproc))
+      return -1;
+    if((sz = reserveuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   } else if(n < 0){
+    release_swap_slots(curproc, curproc->pgdir, PGROUNDUP(sz + n), sz);
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   }
+  // deallocuvm flushed the pages it unmapped
   curproc->sz = sz;
-  switchuvm(curproc);
   return 0;
 }
 
@@ -193,7 +203,7 @@ fork(void)
   struct proc *curproc = myproc();
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
 
@@ -204,15 +214,26 @@ fork(void)
     np->state = UNUSED;
     return -1;
   }
+  if(dup_vmas(curproc, np) < 0){
+    munmap_all(np);
+    freevm(np->pgdir);
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
 
   memmove(&np->pmeta, &curproc->pmeta, sizeof(PageMeta));
+  dup_zswap_pages(&np->pmeta);
+  np->pmeta.npinned = 0;
 
   if(curproc->pid > 2 && curproc->pmeta.file_exists) {
     copySwapFile(curproc, np);
   }
 
-  np->pmeta.rt_meta.num_page_faults = 0;
-  np->pmeta.rt_meta.num_paged_out_ever = 0;
+  // the child starts its own counters, but inherits the protected pages
+  memset(&np->pmeta.rt_meta, 0, sizeof(RuntimeMeta));
+  np->pmeta.rt_meta.num_protected_pages = curproc->pmeta.rt_meta.num_protected_pages;
 
   arrange_pva_linklist_of_newborn_proc(np->pgdir, find_entry(curproc->pgdir)->first);
 
@@ -227,6 +248,13 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  for(i = 0; i < NFILEMAP; i++){
+    np->fmap[i] = curproc->fmap[i];
+    if(np->fmap[i].ip)
+      idup(np->fmap[i].ip);
+  }
+  np->largepages = curproc->largepages;
+  np->mergeable = curproc->mergeable;
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -254,6 +282,9 @@ exit(void)
   if(curproc == initproc)
     panic("init exiting");
 
+  // Write back and drop mapped files before their inodes go.
+  munmap_all(curproc);
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -264,10 +295,12 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  clear_filemaps(curproc->fmap);
   end_op();
   curproc->cwd = 0;
 
   // task 2
+  free_zswap_pages(&curproc->pmeta);
   if(curproc->pmeta.file_exists)
     removeSwapFile(curproc);
 
@@ -354,11 +387,16 @@ wait(void)
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
+// The page table of the last process stays loaded while the
+// scheduler holds ptable.lock: meanwhile no other CPU can run that
+// process or free its page table, and if it is chosen again
+// switchuvm need not reload cr3.
 void
 scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int ran;
   c->proc = 0;
   
   for(;;){
@@ -367,24 +405,28 @@ scheduler(void)
 
     // Loop over process table looking for process to run.
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
-        continue;
-
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-      c->proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
-
-      swtch(&(c->scheduler), p->context);
-      switchkvm();
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
-    }
+    do {
+      ran = 0;
+      for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+        if(p->state != RUNNABLE)
+          continue;
+
+        // Switch to chosen process.  It is the process's job
+        // to release ptable.lock and then reacquire it
+        // before jumping back to us.
+        c->proc = p;
+        switchuvm(p);
+        p->state = RUNNING;
+
+        swtch(&(c->scheduler), p->context);
+
+        // Process is done running for now.
+        // It should have changed its p->state before coming back.
+        c->proc = 0;
+        ran = 1;
+      }
+    } while(ran);
+    switchkvm();
     release(&ptable.lock);
 
   }
@@ -426,6 +468,37 @@ yield(void)
   release(&ptable.lock);
 }
 
+// A kernel thread's very first scheduling by scheduler() will
+// swtch here. "Return" to the thread's function (see kthread_create).
+static void
+kthreadret(void)
+{
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+}
+
+// Start a kernel thread running fn, which must not return. It has no
+// user memory and never leaves the kernel.
+void
+kthread_create(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc(1)) == 0)
+    panic("kthread_create");
+  if((p->pgdir = setupkvm()) == 0)
+    panic("kthread_create: out of memory");
+  add_entry(p->pgdir);
+  memset(p->tf, 0, sizeof(*p->tf));
+  p->context->eip = (uint)kthreadret;
+  *(uint*)(p->context + 1) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch here.  "Return" to user space.
 void
@@ -578,6 +651,9 @@ void print_total_pages_info() {
   cprintf("%d / %d free pages in the system \n",
       PAGES_AVAILABLE_CURRENTLY,
       PAGES_AVAILABLE_KERNEL_START);
+  kmemdump();
+  zswapdump();
+  ksmdump();
 }
 
 
@@ -589,6 +665,10 @@ void print_total_pages_info() {
  * <protected pages>
  * <page faults>
  * <total number of paged out>
+ * <major faults> <minor faults>
+ * <swap bytes read> <swap bytes written>
+ * <zswap stores> <zswap loads>
+ * <TLB pages flushed> <TLB flushes> <cr3 reloads skipped>
  */
 void
 print_mem_stats(struct proc *p) {
@@ -608,6 +688,93 @@ print_mem_stats(struct proc *p) {
   // total number of paged out
   cprintf(" %d", p->pmeta.rt_meta.num_paged_out_ever);
 
+  // major / minor faults
+  cprintf(" %d %d", p->pmeta.rt_meta.num_major_faults,
+          p->pmeta.rt_meta.num_minor_faults);
+
+  // swap file traffic
+  cprintf(" %d %d", p->pmeta.rt_meta.swap_bytes_read,
+          p->pmeta.rt_meta.swap_bytes_written);
+
+  // compressed swap cache traffic
+  cprintf(" %d %d", p->pmeta.rt_meta.num_zswap_stores,
+          p->pmeta.rt_meta.num_zswap_loads);
+
+  // TLB maintenance
+  cprintf(" %d %d %d", p->pmeta.rt_meta.num_tlb_invlpgs,
+          p->pmeta.rt_meta.num_tlb_flushes, p->pmeta.rt_meta.num_cr3_skips);
+}
+
+// Whether p is stopped where the kernel does not touch its memory:
+// preempted by an interrupt from user space, or asleep in sleep() or
+// wait(). Must hold ptable.lock, which keeps p stopped and its page
+// table unloaded on every CPU.
+int
+user_stopped(struct proc *p)
+{
+  if(p->pgdir == 0 || p->kstack == 0)
+    return 0;
+  if(p->state == RUNNABLE)
+    return p->tf->trapno >= T_IRQ0 && p->tf->trapno != T_SYSCALL &&
+           (p->tf->cs & 3) == DPL_USER;
+  if(p->state == SLEEPING)
+    return p->tf->trapno == T_SYSCALL && (p->chan == &ticks || p->chan == p);
+  return 0;
+}
+
+// Let ksm merge the pages of every mergeable process that is stopped.
+void
+ksm_scan_procs(void)
+{
+  struct proc *p;
+
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    acquire(&ptable.lock);
+    if(p->mergeable && user_stopped(p))
+      ksm_scan(p);
+    release(&ptable.lock);
+  }
+}
+
+// Copy the paging statistics of the process with the given pid to ps.
+// Return -1 if there is no such process.
+int
+getpagestats(int pid, struct pagestats *ps)
+{
+  struct proc *p;
+  RuntimeMeta *rt;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid != pid || p->state == UNUSED)
+      continue;
+
+    rt = &p->pmeta.rt_meta;
+    ps->policy = POLICY;
+    ps->phys_pages = p->pgdir ? count_phys_pages(p->pgdir) : 0;
+    ps->shared_pages = p->pgdir ? count_shared_pages(p->pgdir, p->sz) : 0;
+    ps->large_pages = p->pgdir ? count_large_pages(p->pgdir, p->sz) : 0;
+    ps->paged_out_pages = count_paged_out(&p->pmeta);
+    ps->protected_pages = rt->num_protected_pages;
+    ps->page_faults = rt->num_page_faults;
+    ps->major_faults = rt->num_major_faults;
+    ps->minor_faults = rt->num_minor_faults;
+    ps->fault_cycles = rt->fault_cycles;
+    ps->paged_out_ever = rt->num_paged_out_ever;
+    ps->pages_prefetched = rt->num_pages_prefetched;
+    ps->second_chances = rt->num_second_chances;
+    ps->swap_bytes_read = rt->swap_bytes_read;
+    ps->swap_bytes_written = rt->swap_bytes_written;
+    ps->zswap_stores = rt->num_zswap_stores;
+    ps->zswap_loads = rt->num_zswap_loads;
+    ps->tlb_invlpgs = rt->num_tlb_invlpgs;
+    ps->tlb_flushes = rt->num_tlb_flushes;
+    ps->cr3_skips = rt->num_cr3_skips;
+    release(&ptable.lock);
+    return 0;
+  }
+  release(&ptable.lock);
+  return -1;
 }
 
 void
@@ -695,6 +862,8 @@ void unregister_page(pde_t *pgdir, uint va, uint pa) {
   panic("unregister_page");
 
 found:
+  // register_page links a free slot again
+  removePageFromQueue(&entry->phys_pages[i], pgdir);
   entry->phys_pages[i].va = 0;
   entry->phys_pages[i].pa = 0;
 }
@@ -50,6 +50,28 @@ typedef struct PVA{
   struct PVA *next;
 } PVA;
 
+// An executable segment, paged in from the inode on first touch.
+typedef struct {
+  struct inode *ip;            // Executable, 0 if the slot is unused
+  uint va;                     // Page aligned start of the segment
+  uint off;                    // File offset of va
+  uint filesz;                 // Bytes read from the file, the rest is zero
+  uint memsz;                  // Size of the segment in memory
+} FileMap;
+
+struct shmseg;
+
+// A region mapped by mmap, paged in on first touch.
+typedef struct {
+  uint start;                  // Page aligned, 0 if the slot is unused
+  uint end;                    // Page aligned end of the region
+  int prot;                    // PROT_ bits
+  int flags;                   // MAP_ bits
+  struct file *f;              // Mapped file, 0 for anonymous memory
+  uint off;                    // File offset of start, or of the segment
+  struct shmseg *shm;          // Attached shm segment, or 0
+} VmArea;
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
@@ -69,6 +91,11 @@ struct proc {
   //Swap file. must initiate with create swap file
   struct file *swapFile;      //page file
   PageMeta pmeta;
+
+  FileMap fmap[NFILEMAP];      // Demand paged segments of the executable
+  int largepages;              // Map 4MB aligned heap regions with large pages
+  VmArea vmas[NVMA];           // mmap regions, above the heap
+  int mergeable;               // Let ksmd merge private pages with other processes
 };
 
 typedef struct {
@@ -103,6 +130,11 @@ void print_entry(pde_t *pgdir);
 
 int count_phys_pages(pde_t *pgdir);
 
+FileMap *find_filemap(struct proc *p, uint va);
+void clear_filemaps(FileMap *fmap);
+
+VmArea *find_vma(struct proc *p, uint va);
+
 // Process memory is laid out contiguously, low addresses first:
 //   text
 //   original data and bss
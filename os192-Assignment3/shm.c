@@ -0,0 +1,197 @@
+// Shared memory segments.
+//
+// shmget makes a segment of zeroed pcache pages, found again by its
+// key. shmat maps it into a MAP_SHARED region of the caller, so
+// processes that attach the same segment, and their forked children,
+// write to the same physical pages. A page is allocated when the
+// first of them touches it. A segment lives until the last region
+// attached to it is unmapped.
+//
+// Every MAP_SHARED anonymous region is a segment no key finds, so
+// fork shares even the pages nobody touched yet.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "mman.h"
+
+struct shmseg {
+  int key;                     // 0 for a segment only its id finds
+  int npages;                  // 0 if the slot is unused
+  int nattach;                 // regions mapping the segment
+  int dying;                   // the last region went, pages being released
+  uint pa[SHMMAXPAGES];        // the segment holds a pcache reference to each,
+                               // 0 until first touched
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg segs[NSHM];
+} shm;
+
+void
+shminit(void)
+{
+  initlock(&shm.lock, "shm");
+}
+
+// Return the segment with key, making one of size bytes and nattach
+// regions if there is none. Key 0 always makes a new segment.
+// Returns 0 if size is too large or when out of segments.
+static struct shmseg*
+shm_find(int key, uint size, int nattach)
+{
+  struct shmseg *s, *free = 0;
+  int npages = PGROUNDUP(size) / PGSIZE;
+
+  if(npages == 0 || npages > SHMMAXPAGES)
+    return 0;
+
+  acquire(&shm.lock);
+  for(s = shm.segs; s < &shm.segs[NSHM]; s++){
+    if(key && s->npages && !s->dying && s->key == key){
+      release(&shm.lock);
+      return s;
+    }
+    if(s->npages == 0 && free == 0)
+      free = s;
+  }
+  if(free){
+    free->key = key;
+    free->npages = npages;
+    free->nattach = nattach;
+  }
+  release(&shm.lock);
+  return free;
+}
+
+// Return the id of the segment with key, making one of size bytes
+// if there is none. Key 0 always makes a new segment. Returns -1 if
+// size is too large or when out of segments.
+int
+shmget(int key, uint size)
+{
+  struct shmseg *s;
+
+  if((s = shm_find(key, size, 0)) == 0)
+    return -1;
+  return s - shm.segs;
+}
+
+// A new segment for a MAP_SHARED anonymous region of size bytes,
+// attached to it. Returns 0 if size is too large or when out of
+// segments.
+struct shmseg*
+shm_anon(uint size)
+{
+  return shm_find(0, size, 1);
+}
+
+// Map segment id into the current process. Returns its address, or
+// -1 if there is no such segment or no room for it.
+int
+shmat(int id)
+{
+  struct proc *curproc = myproc();
+  struct shmseg *s;
+  pte_t *pte;
+  int i, va;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shm.segs[id];
+  acquire(&shm.lock);
+  if(s->npages == 0 || s->dying){
+    release(&shm.lock);
+    return -1;
+  }
+  s->nattach++;
+  release(&shm.lock);
+
+  va = mmap(0, s->npages * PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, 0, 0, s);
+  if(va < 0){
+    shm_put(s);
+    return -1;
+  }
+
+  // map the pages others touched already, the rest fault in
+  acquire(&shm.lock);
+  for(i = 0; i < s->npages; i++){
+    if(s->pa[i] == 0)
+      continue;
+    if((pte = non_stat_walkpgdir(curproc->pgdir, (char*)va + i * PGSIZE, 1)) == 0)
+      break;
+    pcache_dup(s->pa[i]);
+    *pte = s->pa[i] | PTE_P | PTE_U | PTE_W | PTE_SH;
+  }
+  release(&shm.lock);
+  return va;
+}
+
+// Unmap the segment attached at addr. Returns -1 if there is none.
+int
+shmdt(uint addr)
+{
+  VmArea *v = find_vma(myproc(), addr);
+
+  if(v == 0 || v->shm == 0 || v->start != addr)
+    return -1;
+  return munmap(v->start, v->end - v->start);
+}
+
+// Page i of s with a new reference, for a region that faults on it.
+// Allocates the page on first use. Returns 0 when out of memory or
+// pcache slots.
+uint
+shm_page(struct shmseg *s, int i)
+{
+  uint pa;
+
+  if(i >= s->npages)
+    panic("shm_page");
+  acquire(&shm.lock);
+  if(s->pa[i] == 0)
+    s->pa[i] = pcache_anon();
+  if((pa = s->pa[i]) != 0)
+    pcache_dup(pa);
+  release(&shm.lock);
+  return pa;
+}
+
+// One more region maps s, for fork and a split region.
+void
+shm_dup(struct shmseg *s)
+{
+  acquire(&shm.lock);
+  s->nattach++;
+  release(&shm.lock);
+}
+
+// A region mapping s went away. Frees s with the last one.
+void
+shm_put(struct shmseg *s)
+{
+  int i;
+
+  acquire(&shm.lock);
+  if(--s->nattach > 0){
+    release(&shm.lock);
+    return;
+  }
+  // nobody finds it now, and the slot stays taken until its
+  // pages are released without shm.lock
+  s->dying = 1;
+  release(&shm.lock);
+
+  for(i = 0; i < s->npages; i++)
+    if(s->pa[i])
+      pcache_put(s->pa[i]);
+
+  acquire(&shm.lock);
+  memset(s, 0, sizeof(*s));
+  release(&shm.lock);
+}
@@ -0,0 +1,144 @@
+// A producer and a consumer pass the same bytes through a pipe and
+// through a ring buffer in a shared memory segment.
+//
+// usage: shmbench [kbytes]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define CHUNK 512
+#define RINGPAGES 8
+#define RINGSZ ((RINGPAGES - 1) * 4096)   // a multiple of CHUNK
+
+struct ring {
+  volatile uint head;          // bytes written by the producer
+  volatile uint tail;          // bytes read by the consumer
+  char data[RINGSZ];
+};
+
+char buf[CHUNK];
+uint want;                     // sum of all the bytes passed
+
+void
+fill(char *p, uint off)
+{
+  int i;
+
+  for(i = 0; i < CHUNK; i++)
+    p[i] = off + i;
+}
+
+uint
+sum(char *p)
+{
+  uint s = 0;
+  int i;
+
+  for(i = 0; i < CHUNK; i++)
+    s += (uchar)p[i];
+  return s;
+}
+
+uint
+expected(int total)
+{
+  uint s = 0, off;
+
+  for(off = 0; off < total; off += CHUNK){
+    fill(buf, off);
+    s += sum(buf);
+  }
+  return s;
+}
+
+int
+bypipe(int total)
+{
+  int fd[2], n, got;
+  uint off, s = 0;
+
+  if(pipe(fd) < 0){
+    printf(1, "shmbench: pipe failed\n");
+    exit();
+  }
+  if(fork() == 0){
+    close(fd[1]);
+    for(off = 0; off < total; off += CHUNK){
+      for(got = 0; got < CHUNK; got += n)
+        if((n = read(fd[0], buf + got, CHUNK - got)) <= 0)
+          exit();
+      s += sum(buf);
+    }
+    if(s != want)
+      printf(1, "shmbench: pipe data corrupted\n");
+    exit();
+  }
+  close(fd[0]);
+  for(off = 0; off < total; off += CHUNK){
+    fill(buf, off);
+    write(fd[1], buf, CHUNK);
+  }
+  close(fd[1]);
+  wait();
+  return 0;
+}
+
+int
+byshm(int total)
+{
+  struct ring *r;
+  int id;
+  uint off, s = 0;
+
+  if((id = shmget(0, sizeof(struct ring))) < 0 || (r = shmat(id)) == (void*)-1){
+    printf(1, "shmbench: shm failed\n");
+    exit();
+  }
+  if(fork() == 0){
+    for(off = 0; off < total; off += CHUNK){
+      while(r->head - r->tail < CHUNK)
+        yield();
+      __sync_synchronize();
+      s += sum(r->data + r->tail % RINGSZ);
+      __sync_synchronize();
+      r->tail += CHUNK;
+    }
+    if(s != want)
+      printf(1, "shmbench: shm data corrupted\n");
+    exit();
+  }
+  for(off = 0; off < total; off += CHUNK){
+    while(r->head - r->tail > RINGSZ - CHUNK)
+      yield();
+    __sync_synchronize();
+    fill(r->data + r->head % RINGSZ, off);
+    __sync_synchronize();
+    r->head += CHUNK;
+  }
+  wait();
+  shmdt(r);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int kb = 2048, total, start;
+
+  if(argc > 1)
+    kb = atoi(argv[1]);
+  if(kb < 1)
+    kb = 1;
+  total = kb * 1024;
+  want = expected(total);
+
+  start = uptime();
+  bypipe(total);
+  printf(1, "pipe: %d KB in %d ticks\n", kb, uptime() - start);
+
+  start = uptime();
+  byshm(total);
+  printf(1, "shm:  %d KB in %d ticks\n", kb, uptime() - start);
+  exit();
+}
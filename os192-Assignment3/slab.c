@@ -0,0 +1,254 @@
+// Slab allocator for small kernel objects.
+//
+// A kmem_cache hands out objects of one size, carved from pages it
+// gets from kalloc. Every page (a slab) starts with a struct slab and
+// holds as many objects as fit after it. A free object is linked to
+// the next one through a word right after it, so the object itself
+// keeps the state the cache's constructor gave it when the slab was
+// made, and callers must free objects in that state.
+//
+// As in kalloc, every CPU keeps a magazine of free objects of each
+// cache, so most calls do not take the cache lock. kmalloc serves
+// other small allocations from caches of power of two sizes.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slabinfo.h"
+
+#define SLABMAG 8              // free objects a CPU keeps per cache
+#define KMALLOC_MIN 32
+#define KMALLOC_MAX 2048
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;           // next slab with free objects
+  char *free;                  // free objects, 0 if the slab is full
+  int inuse;                   // objects handed out or in a magazine
+};
+
+struct objmag {
+  char *objs[SLABMAG];
+  int n;
+};
+
+struct kmem_cache {
+  char name[SLABNAME];
+  uint size;                   // object size, 0 if the cache is unused
+  uint stride;                 // object size and free list link
+  int perslab;
+  void (*ctor)(void*);
+  struct spinlock lock;
+  struct slab *partial;        // slabs with free objects
+  int nslabs;
+  int nactive;                 // objects handed out
+  uint nallocs;
+  struct objmag mag[NCPU];
+};
+
+static char *kmalloc_names[] = {
+  "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256",
+  "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+// the free list link of object o
+#define OBJNEXT(c, o) (*(char**)((o) + (c)->size))
+#define SLABFIRST ((sizeof(struct slab) + 7) & ~7)
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache caches[NSLABCACHE];
+  struct kmem_cache *kmalloc[NELEM(kmalloc_names)];  // KMALLOC_MIN << i bytes
+} slabs;
+
+void
+slabinit(void)
+{
+  int i;
+  uint size;
+
+  initlock(&slabs.lock, "slabs");
+  for(i = 0, size = KMALLOC_MIN; size <= KMALLOC_MAX; i++, size <<= 1)
+    slabs.kmalloc[i] = kmem_cache_create(kmalloc_names[i], size, 0);
+}
+
+// Make a cache of objects of the given size. ctor, if not 0, is
+// called on every object when its slab is made.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size, void (*ctor)(void*))
+{
+  struct kmem_cache *c;
+
+  size = (size + 3) & ~3;
+  if(size == 0 || SLABFIRST + size + sizeof(char*) > PGSIZE)
+    panic("kmem_cache_create");
+
+  acquire(&slabs.lock);
+  for(c = slabs.caches; c < &slabs.caches[NSLABCACHE]; c++)
+    if(c->size == 0)
+      break;
+  if(c == &slabs.caches[NSLABCACHE])
+    panic("kmem_cache_create: no caches");
+
+  memset(c, 0, sizeof(*c));
+  safestrcpy(c->name, name, SLABNAME);
+  c->size = size;
+  c->stride = size + sizeof(char*);
+  c->perslab = (PGSIZE - SLABFIRST) / c->stride;
+  c->ctor = ctor;
+  initlock(&c->lock, c->name);
+  release(&slabs.lock);
+  return c;
+}
+
+// Make a slab and put it on the partial list. Must hold c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *o;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  for(i = c->perslab - 1; i >= 0; i--){
+    o = (char*)s + SLABFIRST + i * c->stride;
+    if(c->ctor)
+      c->ctor(o);
+    OBJNEXT(c, o) = s->free;
+    s->free = o;
+  }
+  s->next = c->partial;
+  c->partial = s;
+  c->nslabs++;
+  return s;
+}
+
+// Give an object back to its slab, freeing the slab once it is
+// empty. Must hold c->lock.
+static void
+slab_put(struct kmem_cache *c, char *o)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint)o);
+  struct slab **pp;
+
+  if(s->free == 0){
+    s->next = c->partial;
+    c->partial = s;
+  }
+  OBJNEXT(c, o) = s->free;
+  s->free = o;
+
+  if(--s->inuse == 0){
+    for(pp = &c->partial; *pp != s; pp = &(*pp)->next)
+      ;
+    *pp = s->next;
+    c->nslabs--;
+    kfree((char*)s);
+  }
+}
+
+// Return a free object of c, or 0 if out of memory.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct objmag *m;
+  struct slab *s;
+  char *o = 0;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < SLABMAG / 2){
+      if((s = c->partial) == 0 && (s = slab_grow(c)) == 0)
+        break;
+      m->objs[m->n++] = s->free;
+      s->free = OBJNEXT(c, s->free);
+      s->inuse++;
+      if(s->free == 0)
+        c->partial = s->next;   // full slabs are off the list
+    }
+    release(&c->lock);
+  }
+  if(m->n > 0)
+    o = m->objs[--m->n];
+  popcli();
+
+  if(o){
+    __sync_fetch_and_add(&c->nactive, 1);
+    __sync_fetch_and_add(&c->nallocs, 1);
+  }
+  return o;
+}
+
+void
+kmem_cache_free(struct kmem_cache *c, void *o)
+{
+  struct objmag *m;
+
+  if(((struct slab*)PGROUNDDOWN((uint)o))->cache != c)
+    panic("kmem_cache_free");
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == SLABMAG){
+    acquire(&c->lock);
+    while(m->n > SLABMAG / 2)
+      slab_put(c, m->objs[--m->n]);
+    release(&c->lock);
+  }
+  m->objs[m->n++] = o;
+  popcli();
+
+  __sync_fetch_and_sub(&c->nactive, 1);
+}
+
+// Allocate n bytes, up to KMALLOC_MAX. Returns 0 if n is too large
+// or out of memory.
+void*
+kmalloc(uint n)
+{
+  int i;
+  uint size;
+
+  for(i = 0, size = KMALLOC_MIN; size <= KMALLOC_MAX; i++, size <<= 1)
+    if(n <= size)
+      return kmem_cache_alloc(slabs.kmalloc[i]);
+  return 0;
+}
+
+void
+kmfree(void *p)
+{
+  kmem_cache_free(((struct slab*)PGROUNDDOWN((uint)p))->cache, p);
+}
+
+// Copy the usage of up to n caches to si. Returns the number copied.
+int
+getslabinfo(struct slabinfo *si, int n)
+{
+  struct kmem_cache *c;
+  int i = 0;
+
+  acquire(&slabs.lock);
+  for(c = slabs.caches; c < &slabs.caches[NSLABCACHE] && i < n; c++){
+    if(c->size == 0)
+      continue;
+    safestrcpy(si[i].name, c->name, SLABNAME);
+    si[i].objsize = c->size;
+    si[i].perslab = c->perslab;
+    si[i].slabs = c->nslabs;
+    si[i].active = c->nactive;
+    si[i].allocs = c->nallocs;
+    i++;
+  }
+  release(&slabs.lock);
+  return i;
+}
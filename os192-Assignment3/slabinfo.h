@@ -0,0 +1,11 @@
+#define SLABNAME 16
+
+// Usage of a slab cache, filled by slabinfo().
+struct slabinfo {
+  char name[SLABNAME];
+  uint objsize;             // Object size in bytes
+  int perslab;              // Objects that fit in one page
+  int slabs;                // Pages the cache holds
+  int active;               // Objects in use
+  uint allocs;              // Objects allocated so far
+};
@@ -0,0 +1,30 @@
+// Print the kernel slab caches and the memory they waste.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "slabinfo.h"
+
+#define NINFO 16
+
+struct slabinfo si[NINFO];
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, used;
+
+  if((n = slabinfo(si, NINFO)) < 0){
+    printf(2, "slabtop: slabinfo failed\n");
+    exit();
+  }
+
+  printf(1, "name size perslab slabs active allocs waste\n");
+  for(i = 0; i < n; i++){
+    used = si[i].active * si[i].objsize;
+    printf(1, "%s  %d  %d  %d  %d  %d  %d\n", si[i].name, si[i].objsize,
+           si[i].perslab, si[i].slabs, si[i].active, si[i].allocs,
+           si[i].slabs * 4096 - used);
+  }
+  exit();
+}
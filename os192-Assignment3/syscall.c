@@ -19,7 +19,9 @@ fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(!user_range_ok(curproc, addr, 4))
+    return -1;
+  if(fill_lazy_range(addr, 4, 0) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -33,12 +35,18 @@ fetchstr(uint addr, char **pp)
 {
   char *s, *ep;
   struct proc *curproc = myproc();
+  VmArea *v;
 
-  if(addr >= curproc->sz)
+  if(addr < curproc->sz)
+    ep = (char*)curproc->sz;
+  else if((v = find_vma(curproc, addr)) != 0)
+    ep = (char*)v->end;
+  else
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && fill_lazy_range((uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -54,24 +62,41 @@ argint(int n, int *ip)
 
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+// lies within the process address space: below sz or in one
+// mmap region.
+static int
+argbuf(int n, char **pp, int size, int write)
 {
   int i;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || !user_range_ok(curproc, (uint)i, size))
+    return -1;
+  if(fill_lazy_range((uint)i, size, write) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+int
+argptr(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 1);
+}
+
+// Like argptr, for a buffer the kernel only reads, which may be
+// a read-only mapping.
+int
+argptr_ro(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 0);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
+// (A string in a MAP_SHARED region can be changed by another process
 // between this check and being used by the kernel.)
 int
 argstr(int n, char **pp)
@@ -109,6 +134,16 @@ extern int sys_check_page_pmalloced(void);
 extern int sys_protect_pg(void);
 extern int sys_check_page_protected(void);
 extern int sys_unprotect_pg(void);
+extern int sys_getpagestats(void);
+extern int sys_slabinfo(void);
+extern int sys_largepages(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_mergeable(void);
+extern int sys_ksminfo(void);
 
 
 static int (*syscalls[])(void) = {
@@ -138,7 +173,17 @@ static int (*syscalls[])(void) = {
 [SYS_check_page_pmalloced]   sys_check_page_pmalloced,
 [SYS_protect_pg]   sys_protect_pg,
 [SYS_check_page_protected]   sys_check_page_protected,
-[SYS_unprotect_pg]   sys_unprotect_pg
+[SYS_unprotect_pg]   sys_unprotect_pg,
+[SYS_getpagestats]   sys_getpagestats,
+[SYS_slabinfo]   sys_slabinfo,
+[SYS_largepages]   sys_largepages,
+[SYS_mmap]   sys_mmap,
+[SYS_munmap]   sys_munmap,
+[SYS_shmget]   sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_mergeable]   sys_mergeable,
+[SYS_ksminfo]   sys_ksminfo
 };
 
 void
@@ -150,6 +195,7 @@ syscall(void)
   num = curproc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     curproc->tf->eax = syscalls[num]();
+    curproc->pmeta.npinned = 0;   // see fill_lazy_range
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
@@ -26,3 +26,13 @@
 #define SYS_protect_pg  25
 #define SYS_check_page_protected  26
 #define SYS_unprotect_pg  27
+#define SYS_getpagestats  28
+#define SYS_slabinfo  29
+#define SYS_largepages  30
+#define SYS_mmap  31
+#define SYS_munmap  32
+#define SYS_shmget  33
+#define SYS_shmat  34
+#define SYS_shmdt  35
+#define SYS_mergeable  36
+#define SYS_ksminfo  37
@@ -6,6 +6,9 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "pagestats.h"
+#include "slabinfo.h"
+#include "ksminfo.h"
 
 
 int sys_yield(void)
@@ -109,6 +112,98 @@ sys_protect_pg(void)
   return protect_pg((void*)va);
 }
 
+int
+sys_getpagestats(void)
+{
+  int pid;
+  struct pagestats *ps;
+
+  if(argint(0, &pid) < 0 || argptr(1, (char**)&ps, sizeof(*ps)) < 0)
+    return -1;
+  return getpagestats(pid, ps);
+}
+
+int
+sys_slabinfo(void)
+{
+  int n;
+  struct slabinfo *si;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NSLABCACHE)
+    n = NSLABCACHE;   // no more are filled in; keeps n * sizeof(*si) small
+  if(argptr(0, (char**)&si, n * sizeof(*si)) < 0)
+    return -1;
+  return getslabinfo(si, n);
+}
+
+// Turn large pages for the heap on or off. They are only used
+// without a paging policy, return -1 otherwise.
+int
+sys_largepages(void)
+{
+  int on;
+
+  if(argint(0, &on) < 0 || POLICY != NONE)
+    return -1;
+  myproc()->largepages = (on != 0);
+  return 0;
+}
+
+int
+sys_shmget(void)
+{
+  int key, size;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0 || size <= 0)
+    return -1;
+  return shmget(key, size);
+}
+
+int
+sys_shmat(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return shmat(id);
+}
+
+int
+sys_shmdt(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return shmdt(addr);
+}
+
+// Let ksmd merge the private pages of this process, and of the
+// children it forks, with identical pages of others.
+int
+sys_mergeable(void)
+{
+  int on;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  myproc()->mergeable = (on != 0);
+  return 0;
+}
+
+int
+sys_ksminfo(void)
+{
+  struct ksminfo *ki;
+
+  if(argptr(0, (char**)&ki, sizeof(*ki)) < 0)
+    return -1;
+  return getksminfo(ki);
+}
+
 int
 sys_sleep(void)
 {
@@ -88,16 +88,61 @@ trap(struct trapframe *tf)
       panic("trap");
     }
 
-    // task1
     void *va = (void*)rcr2();
+
+    // first touch of an mmap page, or a write to a private one
+    if(tf->trapno == T_PGFLT && find_vma(myproc(), (uint)va)) {
+      myproc()->pmeta.rt_meta.num_page_faults++;
+      myproc()->pmeta.rt_meta.num_minor_faults++;
+      if(mmap_fault(myproc(), (uint)va, tf->err & 2) > 0)
+        return;
+      cprintf("pid %d %s: bad access to mapped page 0x%x\n",
+              myproc()->pid, myproc()->name, rcr2());
+      myproc()->killed = 1;
+      break;
+    }
+
+    // first touch of a page reserved by sbrk or exec
+    if(tf->trapno == T_PGFLT && is_lazy_page(myproc(), va)) {
+      uint64 fault_start = rdtsc();
+      myproc()->pmeta.rt_meta.num_page_faults++;
+      myproc()->pmeta.rt_meta.num_minor_faults++;
+      if(page_in_lazy(va) > 0) {
+        myproc()->pmeta.rt_meta.fault_cycles += rdtsc() - fault_start;
+        return;
+      }
+      cprintf("pid %d %s: out of memory for lazy page 0x%x\n",
+              myproc()->pid, myproc()->name, rcr2());
+      myproc()->killed = 1;
+      break;
+    }
+
+    // write to an executable page shared with other processes
+    if(tf->trapno == T_PGFLT && (tf->err & 2) && is_shared_file_page(myproc(), va)) {
+      if(break_file_share(va) > 0)
+        return;
+      cprintf("pid %d %s: out of memory for private page 0x%x\n",
+              myproc()->pid, myproc()->name, rcr2());
+      myproc()->killed = 1;
+      break;
+    }
+
+    // task1
     if(!check_page_flag(va, PTE_W)) {
       tf->trapno = 13;
     }
 
     // task2 - page fault
     if(check_page_flag(va, PTE_PG) && !check_page_flag(va, PTE_P)) {
+      uint64 fault_start = rdtsc();
       myproc()->pmeta.rt_meta.num_page_faults++;
-      page_in_the_missing(va);
+      myproc()->pmeta.rt_meta.num_major_faults++;
+      if(page_in_the_missing(va) < 0){
+        cprintf("pid %d %s: cannot page in 0x%x--kill proc\n",
+                myproc()->pid, myproc()->name, rcr2());
+        myproc()->killed = 1;
+      }
+      myproc()->pmeta.rt_meta.fault_cycles += rdtsc() - fault_start;
       return;
     }
 
@@ -1,5 +1,8 @@
 struct stat;
 struct rtcdate;
+struct pagestats;
+struct slabinfo;
+struct ksminfo;
 
 // system calls
 int fork(void);
@@ -29,6 +32,16 @@ int check_page_pmalloced(const void*);
 int protect_pg(const void*);
 int check_page_protected(const void*);
 int unprotect_pg(const void*);
+int getpagestats(int, struct pagestats*);
+int slabinfo(struct slabinfo*, int);
+int largepages(int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int shmget(int, int);
+void* shmat(int);
+int shmdt(void*);
+int mergeable(int);
+int ksminfo(struct ksminfo*);
 
 // ulib.c
 int stat(char*, struct stat*);
@@ -10,9 +10,40 @@
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+#define TLB_INVLPG_MAX 32  // larger ranges are flushed by reloading cr3
+
+// A process only changes its own page tables, and runs on one CPU
+// at a time, so a changed translation needs flushing on this CPU
+// alone, and only if pgdir is loaded: loading it flushes the TLB.
+
+// Flush the TLB entry of the page at va.
 void
-flush_pgd(pde_t *pgdir) {
-  lcr3(V2P(pgdir));
+tlb_flush_page(pde_t *pgdir, uint va)
+{
+  if(rcr3() != V2P(pgdir))
+    return;
+  invlpg((void*)va);
+  if(myproc())
+    myproc()->pmeta.rt_meta.num_tlb_invlpgs++;
+}
+
+// Flush the TLB entries of [start, end), with a single reload of
+// cr3 when that is cheaper than flushing page by page.
+void
+tlb_flush_range(pde_t *pgdir, uint start, uint end)
+{
+  uint a;
+
+  if(rcr3() != V2P(pgdir) || start >= end)
+    return;
+  if((end - start) / PGSIZE > TLB_INVLPG_MAX){
+    lcr3(V2P(pgdir));
+    if(myproc())
+      myproc()->pmeta.rt_meta.num_tlb_flushes++;
+    return;
+  }
+  for(a = PGROUNDDOWN(start); a < end; a += PGSIZE)
+    tlb_flush_page(pgdir, a);
 }
 
 // Set up CPU's kernel segment descriptors.
@@ -36,7 +67,8 @@ seginit(void)
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page table pages.
+// create any required page table pages. For a large page
+// this is the PDE, which maps all of its 4MB.
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -44,6 +76,8 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if((*pde & PTE_P) && (*pde & PTE_PS))
+    return pde;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
@@ -89,6 +123,31 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   return 0;
 }
 
+// Map va..va+size to pa like mappages, but with a large page for
+// every part that is 4MB aligned, which needs no page table page.
+static int
+mapkpages(pde_t *pgdir, uint va, uint size, uint pa, int perm)
+{
+  uint n;
+
+  while(size > 0){
+    if(va % LPGSIZE == 0 && pa % LPGSIZE == 0 && size >= LPGSIZE){
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS;
+      n = LPGSIZE;
+    } else {
+      n = LPGSIZE - va % LPGSIZE;
+      if(n > size)
+        n = size;
+      if(mappages(pgdir, (void*)va, n, pa, perm) < 0)
+        return -1;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -146,8 +205,8 @@ setupkvm(void)
     panic("PHYSTOP too high");
 
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
+    if(mapkpages(pgdir, (uint)k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm) < 0) {
       freevm(pgdir);
       return 0;
     }
@@ -193,7 +252,14 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
-  lcr3(V2P(p->pgdir));  // switch to process's address space
+  // the scheduler leaves the last process's page table loaded, so a
+  // process running again on this CPU still has its TLB entries
+  if(rcr3() != V2P(p->pgdir)){
+    lcr3(V2P(p->pgdir));  // switch to process's address space
+    p->pmeta.rt_meta.num_tlb_flushes++;
+  } else {
+    p->pmeta.rt_meta.num_cr3_skips++;
+  }
   popcli();
 }
 
@@ -243,6 +309,7 @@ char empty_buf[PGSIZE];
 int
 add_empty_page_to_swap_file(uint page_start_address_va) {
   struct proc *cur_proc = myproc();
+  int offset, zh;
 
   // first time allocate swap file
   if (!cur_proc->pmeta.file_exists) {
@@ -250,16 +317,20 @@ add_empty_page_to_swap_file(uint page_start_address_va) {
     cur_proc->pmeta.file_exists = 1;
   }
 
-  if (cur_proc->pmeta.cur_swap_offset == PGSIZE * PAGE_INFO_NUM)
-    return -1;
-
   memset(empty_buf, 0, PGSIZE);
 
-  writeToSwapFile(cur_proc, empty_buf, cur_proc->pmeta.cur_swap_offset, PGSIZE);
+  if ((zh = zswap_store(empty_buf)) != 0) {
+    cur_proc->pmeta.rt_meta.num_zswap_stores++;
+    save_page_info(&cur_proc->pmeta, 0, page_start_address_va, zh);
+    return 1;
+  }
 
-  save_page_info(&cur_proc->pmeta, cur_proc->pmeta.cur_swap_offset, page_start_address_va);
+  if ((offset = alloc_swap_slot(&cur_proc->pmeta)) == -1)
+    return -1;
 
-  cur_proc->pmeta.cur_swap_offset += PGSIZE;
+  writeToSwapFile(cur_proc, empty_buf, offset, PGSIZE);
+
+  save_page_info(&cur_proc->pmeta, offset, page_start_address_va, 0);
 
   return 1;
 }
@@ -272,9 +343,13 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
   char *mem;
   uint a;
+  pte_t *pte;
 
   struct proc *relevant_proc = myproc();
-  int use_swap = relevant_proc->pid > 2 && (POLICY != NONE);
+  // the swap file and page meta belong to the running image - a new
+  // image built by exec is allocated in memory
+  int use_swap = relevant_proc->pid > 2 && (POLICY != NONE) &&
+                 pgdir == relevant_proc->pgdir;
 
   if(newsz >= KERNBASE)
     return 0;
@@ -320,57 +395,516 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
 
 
-    if(mappages(pgdir, (char*)a, PGSIZE, 0, PTE_W|PTE_U) < 0){
+    // never present, so there is nothing to flush
+    if((pte = walkpgdir(pgdir, (char*)a, 1)) == 0){
       cprintf("allocuvm out of swap memory (2)\n");
       return 0;
-    } else {
-      remove_page_flag((void*)a, PTE_P);
-      set_page_flag((void*)a, PTE_PG);
-      flush_pgd(pgdir);
     }
+    if(*pte & PTE_P)
+      panic("remap");
+    *pte = PTE_W | PTE_U | PTE_PG;
 
   }
   return newsz;
 }
-char from_swap_buffer[PGSIZE], from_phys_buffer[PGSIZE];
+char from_swap_buffer[PREFETCH_MAX * PGSIZE], from_phys_buffer[PREFETCH_MAX * PGSIZE];
+
+// Grow the fault-around window while faults keep landing right after
+// the previously paged-in cluster, fall back to a single page otherwise.
+static void
+update_prefetch_window(PageMeta *pm, uint fault_va)
+{
+  if (fault_va == pm->next_seq_fault_va && pm->prefetch_window > 0) {
+    pm->prefetch_window *= 2;
+    if (pm->prefetch_window > PREFETCH_MAX)
+      pm->prefetch_window = PREFETCH_MAX;
+  } else {
+    pm->prefetch_window = 1;
+  }
+}
+
+// Count the swapped out pages following fault_va (up to window pages,
+// fault_va included) whose swap slots directly follow offset, so they
+// can all be read with a single swap file access. Pages kept in zswap
+// have no slot and end the cluster.
+static int
+collect_page_cluster(struct proc *p, uint fault_va, uint offset, int window)
+{
+  int n = 1;
+  uint va = fault_va + PGSIZE;
+  PageInfo *pinfo;
+  pte_t *pte;
+
+  for(; n < window && va < p->sz; n++, va += PGSIZE) {
+    if ((pte = walkpgdir(p->pgdir, (void*)va, 0)) == 0)
+      break;
+    if (!(*pte & PTE_PG) || (*pte & PTE_P))
+      break;
+    if (!(pinfo = find_page(&p->pmeta, va)) || pinfo->zhandle)
+      break;
+    if (pinfo->offset != offset + n * PGSIZE)
+      break;
+  }
+
+  return n;
+}
 
 int page_in_the_missing(void *va) {
 
   struct proc *cur_proc = myproc();
   PageMeta *pm = &cur_proc->pmeta;
-
-  // read page from file - and remove it's meta from proc->page_meta
-  int offset;
-  uint actual_oofset;
-  if ((offset= offset_of_page(pm, (uint)va)) == -1) {
+  uint fault_va = va_to_pg_va_uint((uint)va);
+  uint page_va;
+  PVA losers[PREFETCH_MAX];
+  PVA *updated_pva;
+  PageInfo *pinfo;
+  int zh[PREFETCH_MAX];
+  int slots[PREFETCH_MAX];
+  int n, i, j, phys;
+
+  // read page from zswap or from the file - and remove it's meta from proc->page_meta
+  uint offset;
+  if (!(pinfo = find_page(pm, fault_va)))
     panic("Page meta is absent");
+  offset = pinfo->offset;
+
+  update_prefetch_window(pm, fault_va);
+  if (pinfo->zhandle) {
+    n = 1;
+  } else {
+    n = collect_page_cluster(cur_proc, fault_va, offset, pm->prefetch_window);
+
+    // every page brought in needs a physical page to replace
+    phys = count_phys_pages(cur_proc->pgdir);
+    if (n > phys && phys > 0)
+      n = phys;
+  }
+
+  // pick all the losers before any cluster page enters the queue,
+  // otherwise LIFO would hand back the page we just brought in.
+  // Pages pinned by a system call stay, so there may be fewer.
+  for (i = 0; i < n; i++) {
+    losers[i] = clear_some_physical_page(from_phys_buffer + i * PGSIZE, va);
+    if (losers[i].pa == 0)
+      break;
+  }
+  if ((n = i) == 0)
+    return -1;
+
+  if (pinfo->zhandle) {
+    zswap_load(pinfo->zhandle, from_swap_buffer);
+    zswap_free(pinfo->zhandle);
+    pm->rt_meta.num_zswap_loads++;
   } else {
-    actual_oofset = (uint)offset;
+    readFromSwapFile(cur_proc, from_swap_buffer, offset, n * PGSIZE);
+    for (i = 0; i < n; i++)
+      free_swap_slot(pm, offset + i * PGSIZE);
+  }
+
+  for (i = 0; i < n; i++) {
+    page_va = fault_va + i * PGSIZE;
+    clean_page_info(pm, page_va);
+
+    // setup pte
+    remove_page_flag((void*)page_va, PTE_PG);
+    set_page_flag((void*)page_va, PTE_P);
+    register_phys_address((void*)page_va, losers[i].pa);
+
+    memmove((void*)page_va, from_swap_buffer + i * PGSIZE, PGSIZE);
+    updated_pva = update_page_va(cur_proc, page_va, losers[i].pa);
+
+    addPageToEndOfQueue(updated_pva, cur_proc->pgdir);
+  }
+
+  // the paged out pgs that compress stay in zswap, the rest take over
+  // free slots - usually the ones the cluster was read from
+  for (i = 0; i < n; i++) {
+    slots[i] = 0;
+    if ((zh[i] = zswap_store(from_phys_buffer + i * PGSIZE)) != 0)
+      pm->rt_meta.num_zswap_stores++;
+    else if ((slots[i] = alloc_swap_slot(pm)) == -1)
+      panic("page_in_the_missing: out of swap slots");
   }
 
-  readFromSwapFile(cur_proc, from_swap_buffer, actual_oofset, PGSIZE);
-  clean_page_info(pm, (uint)va);
+  // one write for every run of consecutive slots
+  for (i = 0; i < n; i = j) {
+    j = i + 1;
+    if (zh[i])
+      continue;
+    while (j < n && !zh[j] && slots[j] == slots[j - 1] + PGSIZE)
+      j++;
+    writeToSwapFile(cur_proc, from_phys_buffer + i * PGSIZE, slots[i], (j - i) * PGSIZE);
+  }
+
+  for (i = 0; i < n; i++)
+    save_page_info(pm, slots[i], losers[i].va, zh[i]);
+
+  cur_proc->pmeta.rt_meta.num_paged_out_ever += n;
+  cur_proc->pmeta.rt_meta.num_pages_prefetched += n - 1;
+  pm->next_seq_fault_va = fault_va + n * PGSIZE;
+
+  return 1;
+}
+
+// Grow the address space from oldsz to newsz without allocating
+// anything. The pages get a zeroed physical page on first touch
+// (page_in_zero), and a swap slot only once they are evicted.
+// Returns new size or 0 on error.
+int
+reserveuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  struct proc *relevant_proc = myproc();
+  int use_swap = relevant_proc->pid > 2 && (POLICY != NONE);
+
+  if(newsz >= KERNBASE)
+    return 0;
+  if(newsz < oldsz)
+    return oldsz;
+
+  // the same bound allocuvm hits once the swap file is full
+  if(use_swap && PGROUNDUP(newsz) > MAX_TOTAL_PAGES * PGSIZE){
+    cprintf("reserveuvm out of swap memory\n");
+    return 0;
+  }
 
-  PVA empty_page_pa_va = clear_some_physical_page(from_phys_buffer, va);
+  return newsz;
+}
 
-  // setup pte
-  remove_page_flag(va, PTE_PG);
-  set_page_flag(va, PTE_P);
-  register_phys_address(va, empty_page_pa_va.pa);
+// A page below sz that was reserved by reserveuvm and never touched -
+// it has neither a physical page nor a swap slot.
+int
+is_lazy_page(struct proc *p, const void *va)
+{
+  pte_t *pte;
+
+  if((uint)va >= p->sz)
+    return 0;
 
-  memmove(va_to_pg_va(va), from_swap_buffer, PGSIZE);
-  PVA *updated_pva = update_page_va(cur_proc, (uint)va_to_pg_va(va), empty_page_pa_va.pa);
+  pte = walkpgdir(p->pgdir, va, 0);
+  return pte == 0 || !(*pte & (PTE_P | PTE_PG));
+}
+
+// Map a zeroed, writable page at a, which must not be mapped yet.
+// When the process is already at MAX_PSYC_PAGES, a loser page is
+// evicted to a new swap slot and its physical page is reused.
+// Returns the kernel address of the page, 0 when out of memory or swap.
+static char*
+alloc_user_page(uint a)
+{
+  struct proc *cur_proc = myproc();
+  PageMeta *pm = &cur_proc->pmeta;
+  int use_swap = cur_proc->pid > 2 && (POLICY != NONE);
+  char *mem;
+  PVA loser;
+  PVA *updated_pva;
+  int offset, zh;
+
+  // make sure the page table exists before anything is evicted
+  if(walkpgdir(cur_proc->pgdir, (char*)a, 1) == 0)
+    return 0;
 
+  if(!use_swap || count_phys_pages(cur_proc->pgdir) < MAX_PSYC_PAGES){
+    if((mem = kalloc()) == 0)
+      return 0;
+    memset(mem, 0, PGSIZE);
+    mappages(cur_proc->pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U);
+    register_page(cur_proc->pgdir, a, V2P(mem));
+    return mem;
+  }
+
+  if (!pm->file_exists) {
+    createSwapFile(cur_proc);
+    pm->file_exists = 1;
+  }
+
+  // reserve a slot first - the loser cannot go back once evicted
+  if ((offset = alloc_swap_slot(pm)) == -1)
+    return 0;
+
+  loser = clear_some_physical_page(from_phys_buffer, (void*)a);
+  if (loser.pa == 0) {
+    free_swap_slot(pm, offset);
+    return 0;
+  }
+  if ((zh = zswap_store(from_phys_buffer)) != 0) {
+    free_swap_slot(pm, offset);
+    offset = 0;
+    pm->rt_meta.num_zswap_stores++;
+  } else {
+    writeToSwapFile(cur_proc, from_phys_buffer, offset, PGSIZE);
+  }
+  save_page_info(pm, offset, loser.va, zh);
+  pm->rt_meta.num_paged_out_ever++;
+
+  mem = P2V(loser.pa);
+  memset(mem, 0, PGSIZE);
+  mappages(cur_proc->pgdir, (char*)a, PGSIZE, loser.pa, PTE_W|PTE_U);
+  updated_pva = update_page_va(cur_proc, a, loser.pa);
   addPageToEndOfQueue(updated_pva, cur_proc->pgdir);
 
-  // save to swap file the paged out pg
-  writeToSwapFile(cur_proc, from_phys_buffer, actual_oofset, PGSIZE);
-  save_page_info(pm, actual_oofset, empty_page_pa_va.va);
-  cur_proc->pmeta.rt_meta.num_paged_out_ever++;
+  return mem;
+}
+
+// Map a zeroed large page over the 4MB region holding va, if the
+// process asked for large pages and nothing in the region is mapped
+// yet. Only without a paging policy, which tracks 4KB pages.
+// Returns 0 on success, -1 to fall back to a 4KB page.
+static int
+page_in_large(uint va)
+{
+  struct proc *p = myproc();
+  uint a = va & ~(LPGSIZE - 1);
+  FileMap *fm;
+  char *mem;
+
+  if(POLICY != NONE || !p->largepages)
+    return -1;
+  if(a + LPGSIZE > p->sz || p->pgdir[PDX(a)] != 0)
+    return -1;
+  for(fm = p->fmap; fm < &p->fmap[NFILEMAP]; fm++)
+    if(fm->ip && fm->va < a + LPGSIZE && a < fm->va + fm->memsz)
+      return -1;
+
+  if((mem = kalloc_pages(LPGORDER)) == 0)
+    return -1;
+  memset(mem, 0, LPGSIZE);
+  p->pgdir[PDX(a)] = V2P(mem) | PTE_P | PTE_W | PTE_U | PTE_PS;
+  return 0;
+}
+
+// Map a 4KB page table over the large page holding va instead, so a
+// single page of it can be changed or freed.
+// Returns 0 on success, -1 when out of memory.
+static int
+split_large_page(pde_t *pgdir, uint va)
+{
+  pde_t *pde = &pgdir[PDX(va)];
+  uint pa = PTE_ADDR(*pde);
+  uint flags = PTE_FLAGS(*pde) & ~PTE_PS;
+  pte_t *pgtab;
+  int i;
+
+  if((pgtab = (pte_t*)kalloc()) == 0)
+    return -1;
+  for(i = 0; i < NPTENTRIES; i++){
+    pgtab[i] = (pa + i * PGSIZE) | flags;
+    register_page(pgdir, PGADDR(PDX(va), i, 0), pa + i * PGSIZE);
+  }
+  // same translations as before, the caller flushes once it changes them
+  *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+  return 0;
+}
+
+// The PTE of the 4KB page at va, splitting a large page if needed.
+static pte_t*
+walkpgdir_small(pde_t *pgdir, const void *va)
+{
+  if((pgdir[PDX(va)] & PTE_PS) && split_large_page(pgdir, (uint)va) < 0)
+    return 0;
+  return walkpgdir(pgdir, va, 0);
+}
+
+// Copy the large page of pgdir at va to d, as a large page if
+// there is a free 4MB block, as 4KB pages otherwise.
+static int
+copy_large_page(pde_t *pgdir, pde_t *d, uint va)
+{
+  pde_t pde = pgdir[PDX(va)];
+  char *src = P2V(PTE_ADDR(pde));
+  char *mem;
+  int i;
+
+  if((mem = kalloc_pages(LPGORDER)) != 0){
+    memmove(mem, src, LPGSIZE);
+    d[PDX(va)] = V2P(mem) | PTE_FLAGS(pde);
+    return 0;
+  }
+
+  for(i = 0; i < NPTENTRIES; i++){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, src + i * PGSIZE, PGSIZE);
+    if(mappages(d, (void*)(va + i * PGSIZE), PGSIZE, V2P(mem), PTE_FLAGS(pde) & ~PTE_PS) < 0){
+      kfree(mem);
+      return -1;
+    }
+    register_page(d, va + i * PGSIZE, V2P(mem));
+  }
+  return 0;
+}
+
+// Map a zeroed page at the lazy page holding va.
+// Returns 1 on success, -1 when out of memory or swap.
+int
+page_in_zero(void *va)
+{
+  if(page_in_large((uint)va) == 0)
+    return 1;
+  if(alloc_user_page(va_to_pg_va_uint((uint)va)) == 0)
+    return -1;
+  return 1;
+}
+
+// Page in a page of an executable segment. Its file content comes
+// from the shared pcache page, mapped read-only. The process reads
+// its own private copy if the pcache is full, or for a last page of
+// the segment that the file continues past.
+// Returns 1 on success, -1 on failure.
+static int
+page_in_file(FileMap *fm, uint a)
+{
+  struct proc *cur_proc = myproc();
+  uint off = fm->off + (a - fm->va);
+  uint n = fm->va + fm->filesz - a;
+  uint pa;
+  char *mem;
+
+  if(n > PGSIZE)
+    n = PGSIZE;
+
+  if(walkpgdir(cur_proc->pgdir, (char*)a, 1) == 0)
+    return -1;
+
+  if((pa = pcache_get(fm->ip, off, n)) != 0){
+    mappages(cur_proc->pgdir, (char*)a, PGSIZE, pa, PTE_U|PTE_SH);
+    return 1;
+  }
+
+  if((mem = alloc_user_page(a)) == 0)
+    return -1;
+  ilock(fm->ip);
+  if(readi(fm->ip, mem, off, n) != n){
+    iunlock(fm->ip);
+    return -1;
+  }
+  iunlock(fm->ip);
+  return 1;
+}
+
+// Fill the lazy page holding va: from the executable if it has file
+// content, with zeros otherwise.
+// Returns 1 on success, -1 when out of memory or swap.
+int
+page_in_lazy(void *va)
+{
+  struct proc *cur_proc = myproc();
+  uint a = va_to_pg_va_uint((uint)va);
+  FileMap *fm;
+
+  if((fm = find_filemap(cur_proc, a)) != 0 && a < fm->va + fm->filesz)
+    return page_in_file(fm, a);
+  return page_in_zero(va);
+}
+
+// A present page shared with other processes running the same binary.
+int
+is_shared_file_page(struct proc *p, const void *va)
+{
+  pte_t *pte;
+
+  if((uint)va >= p->sz)
+    return 0;
+
+  pte = walkpgdir(p->pgdir, va, 0);
+  return pte != 0 && (*pte & PTE_P) && (*pte & PTE_SH);
+}
+
+// Give the process a private, writable copy of the shared page
+// holding va. Returns 1 on success, -1 when out of memory or swap.
+int
+break_file_share(void *va)
+{
+  struct proc *cur_proc = myproc();
+  uint a = va_to_pg_va_uint((uint)va);
+  pte_t *pte = walkpgdir(cur_proc->pgdir, (char*)a, 0);
+  pte_t shared = *pte;
+  char *mem;
+
+  *pte = 0;
+  tlb_flush_page(cur_proc->pgdir, a);
 
+  if((mem = alloc_user_page(a)) == 0){
+    *pte = shared;
+    return -1;
+  }
+  memmove(mem, P2V(PTE_ADDR(shared)), PGSIZE);
+  pcache_put(PTE_ADDR(shared));
   return 1;
 }
 
+// Count the pages below sz that are shared through the pcache.
+int
+count_shared_pages(pde_t *pgdir, uint sz)
+{
+  pte_t *pte;
+  uint a;
+  int n = 0;
+
+  for(a = 0; a < sz; a += PGSIZE)
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) != 0 && (*pte & PTE_P) && (*pte & PTE_SH))
+      n++;
+  return n;
+}
+
+// Number of large pages mapped below sz.
+int
+count_large_pages(pde_t *pgdir, uint sz)
+{
+  uint a;
+  int n = 0;
+
+  for(a = 0; a < sz; a += LPGSIZE)
+    if((pgdir[PDX(a)] & PTE_P) && (pgdir[PDX(a)] & PTE_PS))
+      n++;
+  return n;
+}
+
+// Bring the lazy and swapped out pages in [va, va+len) into memory
+// so the kernel can access them on behalf of a system call, and pin
+// them there until it returns: making room for one page of the range
+// must not evict another. Returns -1 if the range does not fit.
+// If the kernel is going to write there, shared executable pages get
+// a private copy as well. mmap pages are handled as a user access
+// would be; they are never evicted.
+int
+fill_lazy_range(uint va, uint len, int write)
+{
+  struct proc *cur_proc = myproc();
+  int use_swap = cur_proc->pid > 2 && (POLICY != NONE);
+  uint a, last;
+  pte_t *pte;
+
+  if(len == 0)
+    return 0;
+
+  a = PGROUNDDOWN(va);
+  last = PGROUNDDOWN(va + len - 1);
+  for(; a <= last; a += PGSIZE){
+    if(find_vma(cur_proc, a)){
+      if(mmap_fault(cur_proc, a, write) < 0)
+        return -1;
+      continue;
+    }
+    if(use_swap && pin_page(&cur_proc->pmeta, a) < 0)
+      return -1;
+    if(is_lazy_page(cur_proc, (void*)a)){
+      if(page_in_lazy((void*)a) < 0)
+        return -1;
+      cur_proc->pmeta.rt_meta.num_page_faults++;
+      cur_proc->pmeta.rt_meta.num_minor_faults++;
+    } else if((pte = walkpgdir(cur_proc->pgdir, (void*)a, 0)) != 0 &&
+              (*pte & PTE_PG) && !(*pte & PTE_P)){
+      if(page_in_the_missing((void*)a) < 0)
+        return -1;
+      cur_proc->pmeta.rt_meta.num_page_faults++;
+      cur_proc->pmeta.rt_meta.num_major_faults++;
+    }
+    if(write && is_shared_file_page(cur_proc, (void*)a) && break_file_share((void*)a) < 0)
+      return -1;
+  }
+  return 0;
+}
+
 void print_flags(void *va) {
   pte_t *pte = walkpgdir(myproc()->pgdir, va, 0);
   cprintf("pte at %p \n", pte);
@@ -393,9 +927,14 @@ void print_flags_pte(pte_t *pte) {
   }
 }
 
+// Evict a page to make room for va, copying it to buf. Returns
+// the page, with pa 0 if every page in memory is pinned.
 PVA clear_some_physical_page(char *buf, void *va) {
   PVA empty_page_pa_va = select_page_to_page_out();
 
+  if (empty_page_pa_va.pa == 0)
+    return empty_page_pa_va;
+
   void *empty_va_pointer = (void*)empty_page_pa_va.va;
   memmove(buf, empty_va_pointer, PGSIZE);
 
@@ -419,39 +958,106 @@ PVA dummy_policy(PVA *phys_pages) {
 PVA select_page_to_page_out() {
 //  PgdirPhysPagesEntry *entry = find_entry(myproc()->pgdir);
 //  return dummy_policy(entry->phys_pages);
+  PVA *loser, none = {0};
 
   if(POLICY == LIFO)
-    return *(select_loser_page_by_lifo());
+    loser = select_loser_page_by_lifo();
   else if (POLICY == SCFIFO)
-    return *(select_loser_page_by_scfifo());
+    loser = select_loser_page_by_scfifo();
   else panic("POLICY WTF?!");
 
+  return loser ? *loser : none;
+}
+
+// Give back the swap slots of p's paged out pages in [from, to), clear
+// their ptes in pgdir and shrink the swap file to the slots still in
+// use. Call before deallocuvm, which only frees pages in memory.
+void
+release_swap_slots(struct proc *p, pde_t *pgdir, uint from, uint to)
+{
+  PageMeta *pm = &p->pmeta;
+  PageInfo *pinfo;
+  pte_t *pte;
+  int released = 0;
+
+  for(pinfo = pm->paged_out_pages; pinfo < &pm->paged_out_pages[PAGE_INFO_NUM]; pinfo++){
+    if(!pinfo->is_valid || pinfo->virt_address < from || pinfo->virt_address >= to)
+      continue;
+
+    if((pte = walkpgdir(pgdir, (char*)pinfo->virt_address, 0)) != 0)
+      *pte = 0;
+    if(pinfo->zhandle)
+      zswap_free(pinfo->zhandle);
+    else
+      free_swap_slot(pm, pinfo->offset);
+    memset(pinfo, 0, sizeof(*pinfo));
+    released++;
+  }
+
+  if(released && pm->file_exists)
+    truncateSwapFile(p, swap_slots_end(pm));
+}
+
+// Whether the page table pgtab maps nothing. Paged out pages
+// still count.
+static int
+pgtab_empty(pte_t *pgtab)
+{
+  int i;
+
+  for(i = 0; i < NPTENTRIES; i++)
+    if(pgtab[i])
+      return 0;
+  return 1;
 }
 
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
+// Goes one page table at a time, skipping the 4MB of each absent
+// one, and frees the page tables left mapping nothing.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
-  pte_t *pte;
-  uint a, pa;
+  pde_t *pde;
+  pte_t *pgtab, *pte;
+  uint a, next, end, pa;
 
   if(newsz >= oldsz)
     return oldsz;
 
-  a = PGROUNDUP(newsz);
-  for(; a  < oldsz; a += PGSIZE){
-    pte = walkpgdir(pgdir, (char*)a, 0);
-    if(!pte)
-      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
-    else if((*pte & PTE_P) != 0){
+  end = PGROUNDUP(oldsz);
+  for(a = PGROUNDUP(newsz); a < end; a = next){
+    next = PGADDR(PDX(a) + 1, 0, 0);
+    pde = &pgdir[PDX(a)];
+    if(!(*pde & PTE_P))
+      continue;
+    if(*pde & PTE_PS){
+      if(a % LPGSIZE == 0 && next <= end){
+        kfree_pages(P2V(PTE_ADDR(*pde)), LPGORDER);
+        *pde = 0;
+        continue;
+      }
+      if(split_large_page(pgdir, a) < 0)
+        panic("deallocuvm: split");
+    }
+    pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
+    for(pte = &pgtab[PTX(a)]; a < next && a < end; pte++, a += PGSIZE){
+      if((*pte & PTE_P) == 0)
+        continue;
       pa = PTE_ADDR(*pte);
       if(pa == 0){
         print_flags_pte(pte);
         panic("kfree");
       }
+      // executable page shared through the pcache
+      if(*pte & PTE_SH){
+        pcache_put(pa);
+        *pte = 0;
+        continue;
+      }
+
       char *v = P2V(pa);
       kfree(v);
 
@@ -459,12 +1065,19 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
       *pte = 0;
     }
+    if(pgtab_empty(pgtab)){
+      kfree((char*)pgtab);
+      *pde = 0;
+    }
   }
+  // also drops the freed page tables from the paging-structure caches
+  tlb_flush_range(pgdir, PGROUNDUP(newsz), oldsz);
   return newsz;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part. deallocuvm frees the user page tables,
+// what is left maps the kernel.
 void
 freevm(pde_t *pgdir)
 {
@@ -474,7 +1087,8 @@ freevm(pde_t *pgdir)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
   for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+    // large pages left are the kernel's direct map
+    if((pgdir[i] & PTE_P) && !(pgdir[i] & PTE_PS)){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
     }
@@ -515,16 +1129,30 @@ copyuvm(pde_t *pgdir, uint sz)
 
   for(i = 0; i < sz; i += PGSIZE){
 
+    if(pgdir[PDX(i)] & PTE_PS){
+      if(copy_large_page(pgdir, d, i) < 0)
+        goto bad;
+      i += LPGSIZE - PGSIZE;
+      continue;
+    }
+
+    // never touched since sbrk - stays lazy in the child too
     if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: phys_address should exist");
+      continue;
 
     if(!(*pte & PTE_P) && !(*pte & PTE_PG))
-      panic("copyuvm: page not present");
+      continue;
 
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
 
-    if (! (*pte & PTE_PG)) {
+    if (*pte & PTE_SH) {
+      // executable page - the child shares it as well
+      if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+        goto bad;
+      pcache_dup(pa);
+
+    } else if (! (*pte & PTE_PG)) {
       if((mem = kalloc()) == 0)
         goto bad;
 
@@ -564,10 +1192,12 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
+  if(*pte & PTE_PS)
+    return (char*)P2V(PTE_ADDR(*pte)) + PGROUNDDOWN((uint)uva % LPGSIZE);
   return (char*)P2V(PTE_ADDR(*pte));
 }
 
@@ -604,20 +1234,16 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 //PAGEBREAK!
 // Blank page.
 
-void flush_pgdir(struct proc* p) {
-  lcr3(V2P(p->pgdir));
-}
-
 void
 set_page_flag(const void *va, uint flag_t) {
   struct proc *cur_proc = myproc();
-  pte_t *relevant_page =  walkpgdir(cur_proc->pgdir, va, 0);
+  pte_t *relevant_page =  walkpgdir_small(cur_proc->pgdir, va);
 
   if(relevant_page == 0)
     panic("set_page_flag");
 
   *relevant_page |= flag_t;
-  flush_pgdir(cur_proc);
+  tlb_flush_page(cur_proc->pgdir, (uint)va);
 }
 
 
@@ -625,13 +1251,13 @@ set_page_flag(const void *va, uint flag_t) {
 void
 remove_page_flag(const void *va, uint flag_t) {
   struct proc *cur_proc = myproc();
-  pte_t *relevant_page =  walkpgdir(cur_proc->pgdir, va, 0);
+  pte_t *relevant_page =  walkpgdir_small(cur_proc->pgdir, va);
 
   if(relevant_page == 0)
     panic("remove_page_flag");
 
   *relevant_page &= ~flag_t;
-  flush_pgdir(cur_proc);
+  tlb_flush_page(cur_proc->pgdir, (uint)va);
 }
 
 int
@@ -653,13 +1279,13 @@ check_page_flag(const void *va, uint flag_t){
 void
 zero_out_phys_address(const void *va) {
   struct proc *cur_proc = myproc();
-  pte_t *relevant_page =  walkpgdir(cur_proc->pgdir, va, 0);
+  pte_t *relevant_page =  walkpgdir_small(cur_proc->pgdir, va);
 
   if(relevant_page == 0)
     panic("zero_out_phys_address");
 
   *relevant_page &= ZERO_ADDRESS;
-  flush_pgdir(cur_proc);
+  tlb_flush_page(cur_proc->pgdir, (uint)va);
 }
 
 void
@@ -0,0 +1,237 @@
+// Compressed cache in front of the swap files.
+//
+// An evicted page is first offered to zswap_store. A page filled with
+// a single word (zero pages included) is kept as that word alone.
+// Other pages are run-length encoded by words, and kept if they
+// shrink to half a page: every pool page holds two of them. Pages
+// that do not compress that well go to the swap file as before.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+#define ZWORDS     (PGSIZE / 4)
+#define ZHALF      (PGSIZE / 2)
+#define ZRUN       0x80000000   // header of a run, the low bits count words
+
+struct zentry {
+  int ref;      // 0 if the entry is free
+  int pool;     // pool page holding the data, -1 for a filled page
+  int half;     // half of the pool page holding the data
+  uint fill;    // the word a filled page is made of
+  uint len;     // compressed length in words
+};
+
+struct {
+  struct spinlock lock;
+  struct zentry entries[NZSWAP];
+  char *pool[NZPOOL];      // pool pages, 0 if not allocated
+  uchar halves[NZPOOL];    // bit h set - half h of the pool page in use
+  int npages;              // pages stored
+  uint scratch[ZHALF / 4]; // compression output
+} zswap;
+
+void
+zswapinit(void)
+{
+  initlock(&zswap.lock, "zswap");
+}
+
+// Encode the page at src into dst as runs (ZRUN | count, word) and
+// literals (count, words...). Returns the length in words, or -1 if
+// it would not fit in max words.
+static int
+zcompress(uint *src, uint *dst, int max)
+{
+  int i = 0, o = 0, j, lit;
+
+  while(i < ZWORDS){
+    for(j = i + 1; j < ZWORDS && src[j] == src[i]; j++)
+      ;
+    if(j - i >= 2){
+      if(o + 2 > max)
+        return -1;
+      dst[o++] = ZRUN | (j - i);
+      dst[o++] = src[i];
+      i = j;
+      continue;
+    }
+
+    // literal words up to the start of the next run
+    lit = i;
+    while(i < ZWORDS && !(i + 1 < ZWORDS && src[i + 1] == src[i]))
+      i++;
+    if(o + 1 + (i - lit) > max)
+      return -1;
+    dst[o++] = i - lit;
+    memmove(&dst[o], &src[lit], (i - lit) * 4);
+    o += i - lit;
+  }
+
+  return o;
+}
+
+static void
+zdecompress(uint *src, uint len, uint *dst)
+{
+  uint i = 0, n, w;
+
+  while(i < len){
+    n = src[i] & ~ZRUN;
+    if(src[i] & ZRUN){
+      w = src[i + 1];
+      while(n-- > 0)
+        *dst++ = w;
+      i += 2;
+    } else {
+      memmove(dst, &src[i + 1], n * 4);
+      dst += n;
+      i += 1 + n;
+    }
+  }
+}
+
+// Find a free half of a pool page, allocating a pool page if needed.
+// Must hold zswap.lock.
+static int
+zalloc_half(int *pg, int *half)
+{
+  int i, free = -1;
+
+  for(i = 0; i < NZPOOL; i++){
+    if(zswap.pool[i] && zswap.halves[i] != 3){
+      *pg = i;
+      *half = zswap.halves[i] & 1;
+      zswap.halves[i] |= 1 << *half;
+      return 0;
+    }
+    if(!zswap.pool[i] && free < 0)
+      free = i;
+  }
+
+  if(free < 0 || (zswap.pool[free] = kalloc()) == 0)
+    return -1;
+  *pg = free;
+  *half = 0;
+  zswap.halves[free] = 1;
+  return 0;
+}
+
+// Keep a copy of page in zswap.
+// Returns its handle, or 0 if the page has to go to the swap file.
+int
+zswap_store(char *page)
+{
+  struct zentry *ze;
+  int len, pg, half;
+
+  acquire(&zswap.lock);
+  for(ze = zswap.entries; ze < &zswap.entries[NZSWAP]; ze++)
+    if(ze->ref == 0)
+      break;
+  if(ze == &zswap.entries[NZSWAP])
+    goto fail;
+
+  if((len = zcompress((uint*)page, zswap.scratch, ZHALF / 4)) < 0)
+    goto fail;
+
+  if(len == 2 && (zswap.scratch[0] & ZRUN)){
+    // one run over the whole page
+    ze->pool = -1;
+    ze->fill = zswap.scratch[1];
+  } else {
+    if(zalloc_half(&pg, &half) < 0)
+      goto fail;
+    memmove(zswap.pool[pg] + half * ZHALF, zswap.scratch, len * 4);
+    ze->pool = pg;
+    ze->half = half;
+  }
+  ze->len = len;
+  ze->ref = 1;
+  zswap.npages++;
+  release(&zswap.lock);
+  return ze - zswap.entries + 1;
+
+fail:
+  release(&zswap.lock);
+  return 0;
+}
+
+static struct zentry*
+zentry(int handle)
+{
+  if(handle < 1 || handle > NZSWAP || zswap.entries[handle - 1].ref == 0)
+    panic("zswap handle");
+  return &zswap.entries[handle - 1];
+}
+
+// Copy the page kept under handle to page.
+void
+zswap_load(int handle, char *page)
+{
+  struct zentry *ze;
+  uint *dst = (uint*)page;
+  int i;
+
+  acquire(&zswap.lock);
+  ze = zentry(handle);
+  if(ze->pool < 0){
+    for(i = 0; i < ZWORDS; i++)
+      dst[i] = ze->fill;
+  } else {
+    zdecompress((uint*)(zswap.pool[ze->pool] + ze->half * ZHALF), ze->len, dst);
+  }
+  release(&zswap.lock);
+}
+
+// Another page table refers to the page kept under handle, for fork.
+void
+zswap_dup(int handle)
+{
+  acquire(&zswap.lock);
+  zentry(handle)->ref++;
+  release(&zswap.lock);
+}
+
+// Drop a reference to the page kept under handle.
+void
+zswap_free(int handle)
+{
+  struct zentry *ze;
+  char *pool = 0;
+
+  acquire(&zswap.lock);
+  ze = zentry(handle);
+  if(--ze->ref > 0){
+    release(&zswap.lock);
+    return;
+  }
+
+  if(ze->pool >= 0){
+    zswap.halves[ze->pool] &= ~(1 << ze->half);
+    if(zswap.halves[ze->pool] == 0){
+      pool = zswap.pool[ze->pool];
+      zswap.pool[ze->pool] = 0;
+    }
+  }
+  memset(ze, 0, sizeof(*ze));
+  zswap.npages--;
+  release(&zswap.lock);
+
+  if(pool)
+    kfree(pool);
+}
+
+void
+zswapdump(void)
+{
+  int i, npool = 0;
+
+  for(i = 0; i < NZPOOL; i++)
+    if(zswap.pool[i])
+      npool++;
+  cprintf("%d pages in zswap using %d pool pages \n", zswap.npages, npool);
+}
@@ -0,0 +1,94 @@
+// Page allocator throughput. Every child repeatedly grows its heap,
+// touches the new pages and gives them back, and now and then forks
+// a child that exits at once. Compare runs under make qemu CPUS=1..8.
+// Then one process grows a large heap touching a page every 4MB, forks
+// a child that exits at once, and gives the heap back.
+//
+// usage: allocbench [nprocs]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NPAGES 8
+#define ROUNDS 200
+#define BIGSZ (16 * 1024 * 1024)
+#define BIGROUNDS 20
+
+void
+churn(void)
+{
+  char *mem;
+  int i, round;
+
+  for(round = 0; round < ROUNDS; round++){
+    if((mem = sbrk(NPAGES * 4096)) == (char*)-1){
+      printf(1, "allocbench: sbrk failed\n");
+      exit(0);
+    }
+    for(i = 0; i < NPAGES; i++)
+      mem[i * 4096] = i;
+    sbrk(-NPAGES * 4096);
+
+    if(round % 10 == 0){
+      if(fork() == 0)
+        exit(0);
+      wait(0);
+    }
+  }
+}
+
+void
+bigheap(void)
+{
+  char *mem;
+  int i, round;
+
+  for(round = 0; round < BIGROUNDS; round++){
+    if((mem = sbrk(BIGSZ)) == (char*)-1){
+      printf(1, "allocbench: no %d bytes of heap\n", BIGSZ);
+      return;
+    }
+    for(i = 0; i < BIGSZ; i += 4 * 1024 * 1024)
+      mem[i] = i;
+    if(fork() == 0)
+      exit(0);
+    wait(0);
+    sbrk(-BIGSZ);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 4, i, pid, start;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1)
+    n = 1;
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "allocbench: fork failed\n");
+      break;
+    }
+    if(pid == 0){
+      churn();
+      exit(0);
+    }
+  }
+  for(; i > 0; i--)
+    wait(0);
+
+  printf(1, "allocbench: %d procs, %d pages each, %d ticks\n",
+         n, ROUNDS * NPAGES, uptime() - start);
+
+  start = uptime();
+  bigheap();
+  printf(1, "allocbench: %d rounds of a %d KB heap, %d ticks\n",
+         BIGROUNDS, BIGSZ / 1024, uptime() - start);
+  exit(0);
+}